@@ -0,0 +1,189 @@
+#include "adjust.h"
+
+#include <stdbool.h>
+
+// SSE2 is only used where the compiler may already assume it. AVX2 is picked at
+// run-time, with its functions built through a target attribute.
+#if !defined(IVAC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define ADJUST_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define ADJUST_AVX2
+#define ADJUST_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+// Every value becomes value * contrast + bias, with the bias folding in the
+// average it's mixed with, and for 8-bit values the scale to 0..255 and the
+// rounding. Values are processed as one flat array, value i using bias[i % 4].
+// That holds for any channel count since only 2 and 4 channel images have
+// alpha, and it lines the biases up with SIMD registers.
+static void get_biases(int c, float contrast, float scale, float round,
+                       float bias[4]) {
+    const bool has_alpha = c == 2 || c == 4;
+    for (int i = 0; i < 4; ++i) {
+        const float average = has_alpha && i % c == c - 1 ? 1.0f : 0.5f;
+        bias[i] = average * (1 - contrast) * scale + round;
+    }
+}
+
+static void adjust_u8_scalar(uint8_t* values, size_t n, float contrast,
+                             const float bias[4]) {
+    for (size_t i = 0; i < n; ++i) {
+        float y = values[i] * contrast + bias[i & 3];
+        y = y > 0 ? y : 0;
+        y = y < 255 ? y : 255;
+        values[i] = (uint8_t)y;
+    }
+}
+
+static void adjust_f32_scalar(float* values, size_t n, float contrast,
+                              const float bias[4]) {
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = values[i] * contrast + bias[i & 3];
+    }
+}
+
+#ifdef ADJUST_SSE2
+static inline __m128i adjust_4_sse2(__m128i v, __m128 k, __m128 b) {
+    __m128 y = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), k), b);
+    y = _mm_min_ps(_mm_max_ps(y, _mm_setzero_ps()), _mm_set1_ps(255));
+    return _mm_cvttps_epi32(y);
+}
+
+// These return how many values they did, leaving the rest for the next path
+static size_t adjust_u8_sse2(uint8_t* values, size_t n, float contrast,
+                             const float bias[4]) {
+    const __m128 k = _mm_set1_ps(contrast);
+    const __m128 b = _mm_loadu_ps(bias);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        const __m128i r0 = adjust_4_sse2(_mm_unpacklo_epi16(lo, zero), k, b);
+        const __m128i r1 = adjust_4_sse2(_mm_unpackhi_epi16(lo, zero), k, b);
+        const __m128i r2 = adjust_4_sse2(_mm_unpacklo_epi16(hi, zero), k, b);
+        const __m128i r3 = adjust_4_sse2(_mm_unpackhi_epi16(hi, zero), k, b);
+        _mm_storeu_si128((__m128i*)(values + i),
+                         _mm_packus_epi16(_mm_packs_epi32(r0, r1),
+                                          _mm_packs_epi32(r2, r3)));
+    }
+    return i;
+}
+
+static size_t adjust_f32_sse2(float* values, size_t n, float contrast,
+                              const float bias[4]) {
+    const __m128 k = _mm_set1_ps(contrast);
+    const __m128 b = _mm_loadu_ps(bias);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_loadu_ps(values + i);
+        _mm_storeu_ps(values + i, _mm_add_ps(_mm_mul_ps(v, k), b));
+    }
+    return i;
+}
+#endif
+
+#ifdef ADJUST_AVX2
+static bool avx2_available(void) {
+    // Also checks that the OS saves the YMM registers
+    return __builtin_cpu_supports("avx2");
+}
+
+static ADJUST_AVX2_TARGET size_t adjust_u8_avx2(uint8_t* values, size_t n,
+                                                float contrast,
+                                                const float bias[4]) {
+    const __m256 k = _mm256_set1_ps(contrast);
+    const __m256 b = _mm256_setr_ps(bias[0], bias[1], bias[2], bias[3],
+                                    bias[0], bias[1], bias[2], bias[3]);
+    // Packing works within 128-bit lanes, this puts the groups of 4 bytes
+    // back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i r[4];
+        for (int j = 0; j < 4; ++j) {
+            const __m256i v = _mm256_cvtepu8_epi32(
+                _mm_loadl_epi64((const __m128i*)(values + i + 8 * j)));
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(v), k),
+                                     b);
+            y = _mm256_min_ps(_mm256_max_ps(y, _mm256_setzero_ps()),
+                              _mm256_set1_ps(255));
+            r[j] = _mm256_cvttps_epi32(y);
+        }
+        const __m256i packed =
+            _mm256_packus_epi16(_mm256_packs_epi32(r[0], r[1]),
+                                _mm256_packs_epi32(r[2], r[3]));
+        _mm256_storeu_si256((__m256i*)(values + i),
+                            _mm256_permutevar8x32_epi32(packed, order));
+    }
+    return i;
+}
+
+static ADJUST_AVX2_TARGET size_t adjust_f32_avx2(float* values, size_t n,
+                                                 float contrast,
+                                                 const float bias[4]) {
+    const __m256 k = _mm256_set1_ps(contrast);
+    const __m256 b = _mm256_setr_ps(bias[0], bias[1], bias[2], bias[3],
+                                    bias[0], bias[1], bias[2], bias[3]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(values + i);
+        _mm256_storeu_ps(values + i, _mm256_add_ps(_mm256_mul_ps(v, k), b));
+    }
+    return i;
+}
+#endif
+
+// Each path stops at a multiple of 4 values, so the next one still starts at
+// bias[0]
+void adjust_contrast(uint8_t* pixels, size_t num_pixels, int c,
+                     float contrast) {
+    float bias[4];
+    get_biases(c, contrast, 255, 0.5f, bias);
+    const size_t n = num_pixels * c;
+    size_t i = 0;
+#ifdef ADJUST_AVX2
+    if (avx2_available()) {
+        i = adjust_u8_avx2(pixels, n, contrast, bias);
+    }
+#endif
+#ifdef ADJUST_SSE2
+    i += adjust_u8_sse2(pixels + i, n - i, contrast, bias);
+#endif
+    adjust_u8_scalar(pixels + i, n - i, contrast, bias);
+}
+
+void adjust_contrast_f32(float* pixels, size_t num_pixels, int c,
+                         float contrast) {
+    float bias[4];
+    get_biases(c, contrast, 1, 0, bias);
+    const size_t n = num_pixels * c;
+    size_t i = 0;
+#ifdef ADJUST_AVX2
+    if (avx2_available()) {
+        i = adjust_f32_avx2(pixels, n, contrast, bias);
+    }
+#endif
+#ifdef ADJUST_SSE2
+    i += adjust_f32_sse2(pixels + i, n - i, contrast, bias);
+#endif
+    adjust_f32_scalar(pixels + i, n - i, contrast, bias);
+}
+
+void adjust_contrast_ref(uint8_t* pixels, size_t num_pixels, int c,
+                         float contrast) {
+    float bias[4];
+    get_biases(c, contrast, 255, 0.5f, bias);
+    adjust_u8_scalar(pixels, num_pixels * c, contrast, bias);
+}
+
+void adjust_contrast_f32_ref(float* pixels, size_t num_pixels, int c,
+                             float contrast) {
+    float bias[4];
+    get_biases(c, contrast, 1, 0, bias);
+    adjust_f32_scalar(pixels, num_pixels * c, contrast, bias);
+}
@@ -0,0 +1,26 @@
+#ifndef IVAC_SRC_ADJUST_H_QXHUQPHW
+#define IVAC_SRC_ADJUST_H_QXHUQPHW
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The image shader's contrast adjustment on the CPU, for processing images
+// without a GL context. Colors are mixed with mid grey and alpha with 1 by
+// contrast, so 1 leaves the image unchanged. The last channel of 2 and 4
+// channel images is alpha.
+//
+// 8-bit results are rounded and clamped like the shader's output is when it's
+// stored in an 8-bit framebuffer. Uses SSE2 or AVX2 where available.
+void adjust_contrast(uint8_t* pixels, size_t num_pixels, int c,
+                     float contrast);
+// Same for float pixels, which aren't clamped, like a float framebuffer
+void adjust_contrast_f32(float* pixels, size_t num_pixels, int c,
+                         float contrast);
+
+// Plain C versions of the above, as a reference for the SIMD paths
+void adjust_contrast_ref(uint8_t* pixels, size_t num_pixels, int c,
+                         float contrast);
+void adjust_contrast_f32_ref(float* pixels, size_t num_pixels, int c,
+                             float contrast);
+
+#endif /* IVAC_SRC_ADJUST_H_QXHUQPHW */
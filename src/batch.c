@@ -0,0 +1,524 @@
+#include "batch.h"
+
+#include "adjust.h"
+#include "headless.h"
+#include "loader.h"
+#include "pool.h"
+#include "render.h"
+#include "save.h"
+#include "shader.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include "tiles.h"
+#include "timers.h"
+#include "trace.h"
+#include "upload.h"
+#include "vertex_object.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <glob.h>
+#endif
+
+#define BATCH_USAGE                                                            \
+    "usage: ivac --batch --out DIR --contrast K [--threads N] [--gpu] "        \
+    "PATTERN...\n"
+
+// How many saves the GPU path lets pile up before waiting for the writer,
+// each one holds a whole image in a pixel buffer
+#define GPU_MAX_PENDING_SAVES 2
+
+typedef struct batch {
+    const char* out_dir;
+    float contrast;
+    char** paths;
+    int num_paths;
+    int capacity;
+    // Where each path is written, all different from each other and from the
+    // inputs
+    char** out_paths;
+    // Set for each path that was processed and written successfully
+    bool* ok;
+} Batch;
+
+static void free_batch(Batch* batch) {
+    for (int i = 0; i < batch->num_paths; ++i) {
+        free(batch->paths[i]);
+        if (batch->out_paths) {
+            free(batch->out_paths[i]);
+        }
+    }
+    free(batch->paths);
+    free(batch->out_paths);
+    free(batch->ok);
+}
+
+static bool add_path(Batch* batch, const char* path) {
+    if (batch->num_paths == batch->capacity) {
+        const int capacity = batch->capacity ? batch->capacity * 2 : 64;
+        char** const paths = realloc(batch->paths, sizeof(char*) * capacity);
+        if (paths == NULL) {
+            return false;
+        }
+        batch->paths = paths;
+        batch->capacity = capacity;
+    }
+    const size_t size = strlen(path) + 1;
+    char* const copy = malloc(size);
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, path, size);
+    batch->paths[batch->num_paths++] = copy;
+    return true;
+}
+
+// Adds every file matching pattern. Without glob() the pattern is taken as a
+// path, the shell will usually have expanded it already anyway.
+static bool add_pattern(Batch* batch, const char* pattern) {
+#ifndef _WIN32
+    glob_t g;
+    const int err = glob(pattern, 0, NULL, &g);
+    if (err == GLOB_NOMATCH) {
+        FATAL_ERROR("no files match %s\n", pattern);
+        return true;
+    }
+    if (err != 0) {
+        FATAL_ERROR("failed to expand %s\n", pattern);
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < g.gl_pathc && ok; ++i) {
+        ok = add_path(batch, g.gl_pathv[i]);
+    }
+    globfree(&g);
+    return ok;
+#else
+    return add_path(batch, pattern);
+#endif
+}
+
+static bool is_png(const char* ext) {
+    const char* const png = ".png";
+    for (int i = 0; i < 5; ++i) {
+        if (tolower((unsigned char)ext[i]) != png[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Output files keep the input's name in out_dir. PNGs stay PNGs, everything
+// else is written as a JPEG.
+static char* get_output_path(const char* out_dir, const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; ++p) {
+#ifdef _WIN32
+        if (*p == '\\') {
+            name = p + 1;
+        }
+#endif
+        if (*p == '/') {
+            name = p + 1;
+        }
+    }
+    const char* const dot = strrchr(name, '.');
+    const size_t stem = dot && dot != name ? (size_t)(dot - name)
+                                           : strlen(name);
+    const char* const ext = dot && is_png(dot) ? ".png" : ".jpg";
+
+    const size_t size = strlen(out_dir) + 1 + stem + strlen(ext) + 1;
+    char* const out = malloc(size);
+    if (out != NULL) {
+        snprintf(out, size, "%s/%.*s%s", out_dir, (int)stem, name, ext);
+    }
+    return out;
+}
+
+// Returns a malloced absolute path to the same file as path, with symbolic
+// links resolved where the platform can, or NULL if it doesn't exist
+static char* resolve_path(const char* path) {
+#ifdef _WIN32
+    return _fullpath(NULL, path, 0);
+#else
+    return realpath(path, NULL);
+#endif
+}
+
+// Windows paths are case insensitive
+#ifdef _WIN32
+#define compare_paths _stricmp
+#else
+#define compare_paths strcmp
+#endif
+
+// An input or output path as it resolves on disk
+typedef struct path_key {
+    char* key;
+    int index;
+    bool output;
+} PathKey;
+
+static int compare_path_keys(const void* a, const void* b) {
+    const PathKey* const x = a;
+    const PathKey* const y = b;
+    const int order = compare_paths(x->key, y->key);
+    if (order != 0) {
+        return order;
+    }
+    if (x->output != y->output) {
+        return x->output - y->output;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// Resolves an output path that usually doesn't exist yet through its
+// directory, so it can be compared with the inputs
+static char* resolve_output_path(const char* out_path,
+                                 const char* resolved_dir) {
+    char* const resolved = resolve_path(out_path);
+    if (resolved != NULL || resolved_dir == NULL) {
+        return resolved ? resolved : strdup(out_path);
+    }
+    const char* const name = strrchr(out_path, '/') + 1;
+    const size_t size = strlen(resolved_dir) + 1 + strlen(name) + 1;
+    char* const out = malloc(size);
+    if (out != NULL) {
+        snprintf(out, size, "%s/%s", resolved_dir, name);
+    }
+    return out;
+}
+
+// Fills in the output paths and checks that no two files would be written to
+// the same one, like a.jpg and a.jpeg, or d1/x.jpg and d2/x.jpg, and that no
+// output would overwrite an input. Reports every clash before failing, so
+// nothing is written at all.
+static bool set_output_paths(Batch* batch) {
+    const int n = batch->num_paths;
+    batch->out_paths = calloc(n, sizeof(char*));
+    PathKey* const keys = calloc(2 * (size_t)n, sizeof(PathKey));
+    char* const resolved_dir = resolve_path(batch->out_dir);
+    bool ok = batch->out_paths != NULL && keys != NULL;
+    for (int i = 0; i < n && ok; ++i) {
+        batch->out_paths[i] = get_output_path(batch->out_dir, batch->paths[i]);
+        ok = batch->out_paths[i] != NULL;
+        if (ok) {
+            char* const input = resolve_path(batch->paths[i]);
+            keys[2 * i] = (PathKey){
+                .key = input ? input : strdup(batch->paths[i]),
+                .index = i,
+                .output = false,
+            };
+            keys[2 * i + 1] = (PathKey){
+                .key = resolve_output_path(batch->out_paths[i], resolved_dir),
+                .index = i,
+                .output = true,
+            };
+            ok = keys[2 * i].key != NULL && keys[2 * i + 1].key != NULL;
+        }
+    }
+    if (ok) {
+        qsort(keys, 2 * (size_t)n, sizeof(PathKey), compare_path_keys);
+    } else {
+        FATAL_ERROR("malloc failed\n");
+    }
+
+    bool clashed = false;
+    for (int i = 1; i < 2 * n && ok; ++i) {
+        const PathKey* const a = &keys[i - 1];
+        const PathKey* const b = &keys[i];
+        if (compare_paths(a->key, b->key) != 0) {
+            continue;
+        }
+        const char* const first = batch->paths[a->index];
+        const char* const second = batch->paths[b->index];
+        if (a->output) {
+            FATAL_ERROR("%s and %s would both be written to %s\n", first,
+                        second, batch->out_paths[a->index]);
+        } else if (!b->output) {
+            FATAL_ERROR("%s is given more than once\n", second);
+        } else if (a->index == b->index) {
+            FATAL_ERROR("%s would be overwritten by its own output\n", first);
+        } else {
+            FATAL_ERROR("the output for %s would overwrite the input %s\n",
+                        second, first);
+        }
+        clashed = true;
+    }
+
+    for (int i = 0; keys != NULL && i < 2 * n; ++i) {
+        free(keys[i].key);
+    }
+    free(keys);
+    free(resolved_dir);
+    return ok && !clashed;
+}
+
+static void process_file(void* data, int i) {
+    Batch* const batch = data;
+    const char* const path = batch->paths[i];
+    int w, h, c;
+    TRACE_BEGIN("decode");
+    uint8_t* const pixels = stbi_load(path, &w, &h, &c, 0);
+    TRACE_END();
+    if (pixels == NULL) {
+        FATAL_ERROR("failed to load %s: %s\n", path, stbi_failure_reason());
+        return;
+    }
+    TRACE_BEGIN("adjust contrast");
+    adjust_contrast(pixels, (size_t)w * h, c, batch->contrast);
+    TRACE_END();
+
+    const char* const out_path = batch->out_paths[i];
+    if (write_image_file(out_path, w, h, c, pixels)) {
+        batch->ok[i] = true;
+    } else {
+        FATAL_ERROR("failed to write %s\n", out_path);
+    }
+    stbi_image_free(pixels);
+}
+
+// Returns how many files were written
+static int process_files_cpu(Batch* batch, ThreadPool* pool) {
+    if (pool) {
+        thread_pool_parallel_for(pool, process_file, batch, batch->num_paths);
+    } else {
+        for (int i = 0; i < batch->num_paths; ++i) {
+            process_file(batch, i);
+        }
+    }
+    int num_ok = 0;
+    for (int i = 0; i < batch->num_paths; ++i) {
+        num_ok += batch->ok[i];
+    }
+    return num_ok;
+}
+
+static pthread_mutex_t saves_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t saves_cond = PTHREAD_COND_INITIALIZER;
+static int num_saves_finished = 0;
+
+static void notify_save_finished(void) {
+    pthread_mutex_lock(&saves_mutex);
+    ++num_saves_finished;
+    pthread_cond_signal(&saves_cond);
+    pthread_mutex_unlock(&saves_mutex);
+}
+
+// Waits until no more than max_pending of the saves started are unfinished
+static void wait_for_saves(ImageSaver* saver, int num_started,
+                           int max_pending) {
+    while (true) {
+        const bool reading_back = image_saver_poll(saver);
+        pthread_mutex_lock(&saves_mutex);
+        const bool done = num_started - num_saves_finished <= max_pending;
+        // Only the writer is left to wait for once nothing is being read back
+        if (!done && !reading_back) {
+            pthread_cond_wait(&saves_cond, &saves_mutex);
+        }
+        pthread_mutex_unlock(&saves_mutex);
+        if (done) {
+            return;
+        }
+    }
+}
+
+// Runs the files through the viewer's own passes on a headless context: each
+// is streamed into tiles, rendered with the image shader into the target
+// tiles, and read back by an image saver, whose thread encodes it while the
+// next file is decoded. The GL work all happens on the calling thread. Falls
+// back to the CPU without a usable context. Returns how many files were
+// written.
+static int process_files_gpu(Batch* batch, ThreadPool* pool) {
+    HeadlessContext ctx;
+    if (!headless_context_init(&ctx)) {
+        fprintf(stderr, "Warning: no OpenGL context, processing on the CPU "
+                        "instead\n");
+        return process_files_cpu(batch, pool);
+    }
+    printf("OpenGL %s on %s\n", glGetString(GL_VERSION),
+           glGetString(GL_RENDERER));
+    gl_debug_init();
+
+    VertexObject quad;
+    {
+        const GLenum types[1] = {GL_FLOAT};
+        const uint8_t counts[1] = {2};
+        vertex_object_init(&quad, 1, types, counts);
+    }
+    build_quad_buffer(quad.vbo);
+    const GLuint image_shader = get_image_shader();
+    GLuint fbo;
+    GLDEBUG(glGenFramebuffers(1, &fbo));
+    TileGrid source, target;
+    tile_grid_init(&source);
+    tile_grid_init(&target);
+    TextureUpload upload;
+    texture_upload_init(&upload);
+
+    ImageSaver saver;
+    const bool have_saver = image_saver_init(&saver, notify_save_finished);
+    int num_started = 0;
+    for (int i = 0; i < batch->num_paths && have_saver; ++i) {
+        const char* const path = batch->paths[i];
+        Image image;
+        TRACE_BEGIN("decode");
+        image.data = stbi_load(path, &image.w, &image.h, &image.c, 0);
+        TRACE_END();
+        if (image.data == NULL) {
+            FATAL_ERROR("failed to load %s: %s\n", path,
+                        stbi_failure_reason());
+            continue;
+        }
+        bool ok = texture_upload_start(&upload, &source,
+                                       bpp_to_gl_image_format(image.c),
+                                       &image);
+        if (ok) {
+            while (!texture_upload_step(&upload)) {
+            }
+            ok = setup_target_tiles(&target, &source, fbo);
+        }
+        if (ok) {
+            apply_contrast(&source, &target, fbo, image_shader, quad.vao,
+                           batch->contrast);
+            ok = image_saver_start(&saver, batch->out_paths[i], &target,
+                                   image.c, fbo);
+        }
+        stbi_image_free(image.data);
+        if (!ok) {
+            FATAL_ERROR("failed to process %s\n", path);
+            continue;
+        }
+        ++num_started;
+        wait_for_saves(&saver, num_started, GPU_MAX_PENDING_SAVES);
+    }
+
+    int num_ok = 0;
+    if (have_saver) {
+        image_saver_deinit(&saver);
+        num_ok = num_started - saver.num_failed;
+    } else {
+        FATAL_ERROR("failed to start the image saver\n");
+    }
+    texture_upload_deinit(&upload);
+    tile_grid_deinit(&source);
+    tile_grid_deinit(&target);
+    GLDEBUG(glDeleteFramebuffers(1, &fbo));
+    GLDEBUG(glDeleteProgram(image_shader));
+    vertex_object_deinit(&quad);
+    headless_context_deinit(&ctx);
+    return num_ok;
+}
+
+// Lets stb_image and stb_image_write split big images across the pool too
+static void parallel_for_callback(void* pool, stbi_parallel_task* task,
+                                  void* data, int count) {
+    thread_pool_parallel_for(pool, task, data, count);
+}
+
+static bool parse_float(const char* s, float* value) {
+    char* end;
+    *value = strtof(s, &end);
+    return end != s && *end == '\0';
+}
+
+static bool parse_int(const char* s, int* value) {
+    char* end;
+    *value = strtol(s, &end, 10);
+    return end != s && *end == '\0';
+}
+
+int batch_main(int argc, const char* const* argv) {
+    Batch batch = {
+        .out_dir = NULL,
+        .contrast = -1,
+        .paths = NULL,
+        .num_paths = 0,
+        .capacity = 0,
+        .out_paths = NULL,
+        .ok = NULL,
+    };
+    int num_threads = get_num_cpus();
+    bool have_contrast = false;
+    bool use_gpu = false;
+    for (int i = 0; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--out") == 0 && has_value) {
+            batch.out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--contrast") == 0 && has_value) {
+            have_contrast = parse_float(argv[++i], &batch.contrast);
+            if (!have_contrast) {
+                FATAL_ERROR("invalid contrast %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            if (!parse_int(argv[++i], &num_threads) || num_threads < 1) {
+                FATAL_ERROR("invalid thread count %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--gpu") == 0) {
+            use_gpu = true;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            FATAL_ERROR("unknown or incomplete option %s\n" BATCH_USAGE,
+                        argv[i]);
+            return 1;
+        } else if (!add_pattern(&batch, argv[i])) {
+            return 1;
+        }
+    }
+    if (batch.out_dir == NULL || !have_contrast) {
+        FATAL_ERROR(BATCH_USAGE);
+        return 1;
+    }
+    if (batch.num_paths == 0) {
+        FATAL_ERROR("no input files\n");
+        return 1;
+    }
+    batch.ok = calloc(batch.num_paths, sizeof(bool));
+    if (batch.ok == NULL) {
+        FATAL_ERROR("malloc failed\n");
+        return 1;
+    }
+    if (!set_output_paths(&batch)) {
+        free_batch(&batch);
+        return 1;
+    }
+
+    // Same settings as the viewer's saves
+    stbi_write_png_fast = true;
+    stbi_write_png_compression_level = 4;
+
+    // Files are spread over the pool on the CPU, and the calling thread works
+    // too. On the GPU the pool only splits up decoding and encoding.
+    ThreadPool pool;
+    const bool have_pool =
+        num_threads > 1 && thread_pool_init(&pool, num_threads - 1);
+    if (have_pool) {
+        stbi_set_parallel_for(parallel_for_callback, &pool);
+        stbi_write_set_parallel_for(parallel_for_callback, &pool);
+    }
+
+    const double start = get_time_ms();
+    ThreadPool* const used_pool = have_pool ? &pool : NULL;
+    const int num_ok = use_gpu ? process_files_gpu(&batch, used_pool)
+                               : process_files_cpu(&batch, used_pool);
+    const double seconds = (get_time_ms() - start) / 1e3;
+
+    if (have_pool) {
+        stbi_set_parallel_for(NULL, NULL);
+        stbi_write_set_parallel_for(NULL, NULL);
+        thread_pool_deinit(&pool);
+    }
+
+    printf("Processed %d of %d images in %.2f s (%.1f images/s)\n", num_ok,
+           batch.num_paths, seconds, num_ok / seconds);
+    const bool all_ok = num_ok == batch.num_paths;
+    free_batch(&batch);
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#ifndef IVAC_SRC_BATCH_H_GN2DNEEW
+#define IVAC_SRC_BATCH_H_GN2DNEEW
+
+// Applies the contrast adjustment to many files without opening a window:
+//
+//   ivac --batch --out DIR --contrast K [--threads N] [--gpu] PATTERN...
+//
+// K is the factor passed to the image shader, 1 leaves images unchanged. The
+// files are spread over N threads, one per CPU by default. With --gpu they go
+// through the image shader on a headless GL context instead. argv holds the
+// arguments after --batch. Returns the process exit code.
+int batch_main(int argc, const char* const* argv);
+
+#endif /* IVAC_SRC_BATCH_H_GN2DNEEW */
@@ -0,0 +1,823 @@
+// ivac_bench: times each stage of processing an image on a synthetic corpus
+// and prints the results as JSON, so changes to any stage can be compared.
+//
+//   ivac_bench [--sizes MP,...] [--channels C,...] [--formats jpg,png,hdr]
+//              [--runs N] [--threads N] [--corpus DIR] [--out FILE]
+//   ivac_bench --kernels [--runs N] [--out FILE]
+//
+// The stages are the ones a save from the viewer goes through: decoding with
+// stbi_load, streaming into tiles, the contrast pass, reading the result back
+// and encoding it as a JPEG. The GL stages run on a headless context and are
+// left out if one can't be created. The CPU version of the contrast pass is
+// timed as well, and so is decoding from a memory mapped file the way the
+// viewer's loader does, along with how many read calls and page faults each
+// way of decoding takes.
+//
+// --kernels times the JPEG decoder's IDCT, color conversion and upsampling
+// kernels on their own instead, calling the plain C, SSE2 and AVX2 versions
+// directly so each can be compared whatever the dispatch would pick.
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "adjust.h"
+#include "headless.h"
+#include "loader.h"
+#include "pool.h"
+#include "render.h"
+#include "shader.h"
+#include "tiles.h"
+#include "timers.h"
+#include "upload.h"
+#include "vertex_object.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define BENCH_USAGE                                                            \
+    "usage: ivac_bench [--sizes MP,...] [--channels C,...] "                   \
+    "[--formats jpg,png,hdr] [--runs N] [--threads N] [--corpus DIR] "         \
+    "[--out FILE]\n"                                                        \
+    "       ivac_bench --kernels [--runs N] [--out FILE]\n"
+
+#define MAX_LIST 16
+// Shader factor of the contrast pass, anything but 1 does the same work
+#define BENCH_CONTRAST 1.5f
+
+enum stage {
+    STAGE_DECODE,
+    STAGE_DECODE_MMAP,
+    STAGE_UPLOAD,
+    STAGE_CONTRAST,
+    STAGE_READBACK,
+    STAGE_CONTRAST_CPU,
+    STAGE_ENCODE,
+    NUM_STAGES,
+};
+
+static const char* const stage_names[NUM_STAGES] = {
+    "decode",   "decode_mmap",  "upload", "contrast",
+    "readback", "contrast_cpu", "encode",
+};
+
+static const bool stage_needs_gl[NUM_STAGES] = {
+    false, false, true, true, true, false, false,
+};
+
+typedef struct gl_state {
+    HeadlessContext ctx;
+    VertexObject quad;
+    GLuint image_shader;
+    GLuint fbo;
+    TileGrid source, target;
+    TextureUpload upload;
+} GLState;
+
+static bool gl_state_init(GLState* gl) {
+    if (!headless_context_init(&gl->ctx)) {
+        return false;
+    }
+    const GLenum types[1] = {GL_FLOAT};
+    const uint8_t counts[1] = {2};
+    vertex_object_init(&gl->quad, 1, types, counts);
+    build_quad_buffer(gl->quad.vbo);
+    gl->image_shader = get_image_shader();
+    GLDEBUG(glGenFramebuffers(1, &gl->fbo));
+    tile_grid_init(&gl->source);
+    tile_grid_init(&gl->target);
+    texture_upload_init(&gl->upload);
+    return true;
+}
+
+static void gl_state_deinit(GLState* gl) {
+    texture_upload_deinit(&gl->upload);
+    tile_grid_deinit(&gl->source);
+    tile_grid_deinit(&gl->target);
+    GLDEBUG(glDeleteFramebuffers(1, &gl->fbo));
+    GLDEBUG(glDeleteProgram(gl->image_shader));
+    vertex_object_deinit(&gl->quad);
+    headless_context_deinit(&gl->ctx);
+}
+
+// Read calls and page faults of the whole process so far, -1 where the
+// platform can't tell
+typedef struct io_counts {
+    long reads;
+    long page_faults;
+} IoCounts;
+
+static IoCounts get_io_counts(void) {
+    IoCounts counts = {-1, -1};
+#ifdef __linux__
+    // syscr counts every read-like system call, and is updated after each
+    // one returns, so the read that fetches it isn't included yet
+    FILE* const f = fopen("/proc/self/io", "r");
+    if (f) {
+        char line[64];
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "syscr: %ld", &counts.reads) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+#endif
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        counts.page_faults = usage.ru_minflt + usage.ru_majflt;
+    }
+#endif
+    return counts;
+}
+
+static long count_since(long start, long end, long overhead) {
+    return start < 0 || end < 0 ? -1 : end - start - overhead;
+}
+
+// What happened since start, minus what getting the counts costs by itself
+static IoCounts get_io_counts_since(IoCounts start) {
+    static bool have_overhead = false;
+    static IoCounts overhead;
+    if (!have_overhead) {
+        const IoCounts a = get_io_counts();
+        const IoCounts b = get_io_counts();
+        overhead.reads = count_since(a.reads, b.reads, 0);
+        overhead.page_faults = count_since(a.page_faults, b.page_faults, 0);
+        have_overhead = true;
+    }
+    const IoCounts end = get_io_counts();
+    return (IoCounts){
+        count_since(start.reads, end.reads, overhead.reads),
+        count_since(start.page_faults, end.page_faults, overhead.page_faults),
+    };
+}
+
+// Smooth gradients with a little noise, so the encoders see something closer
+// to a photo than either flat color or pure noise would be
+static uint8_t* make_image(int w, int h, int c) {
+    uint8_t* const pixels = malloc((size_t)w * h * c);
+    if (pixels == NULL) {
+        return NULL;
+    }
+    uint32_t state = 0x9e3779b9u;
+    uint8_t* p = pixels;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            for (int i = 0; i < c; ++i) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                const int value = (int)((int64_t)x * (i + 1) * 255 / w +
+                                        (int64_t)y * 255 / h) / 2 +
+                                  (int)(state & 15) - 8;
+                *p++ = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+        }
+    }
+    return pixels;
+}
+
+static bool write_corpus_file(const char* path, const char* format, int w,
+                              int h, int c, const uint8_t* pixels) {
+    if (strcmp(format, "png") == 0) {
+        return stbi_write_png(path, w, h, c, pixels, 0);
+    }
+    if (strcmp(format, "hdr") == 0) {
+        const size_t n = (size_t)w * h * c;
+        float* const values = malloc(n * sizeof(float));
+        if (values == NULL) {
+            return false;
+        }
+        // Spread over a range an 8-bit image couldn't hold
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = pixels[i] * (4.0f / 255);
+        }
+        const bool ok = stbi_write_hdr(path, w, h, c, values);
+        free(values);
+        return ok;
+    }
+    return stbi_write_jpg(path, w, h, c, pixels, 95);
+}
+
+static void count_bytes(void* context, void* data, int size) {
+    *(size_t*)context += size;
+}
+
+// Linear interpolation between the closest ranks of sorted
+static double percentile(const double* sorted, int n, double p) {
+    const double rank = p * (n - 1);
+    const int i = (int)rank;
+    if (i + 1 >= n) {
+        return sorted[n - 1];
+    }
+    return sorted[i] + (sorted[i + 1] - sorted[i]) * (rank - i);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Counts the platform can't provide are null
+static void print_json_count(FILE* f, long count) {
+    if (count < 0) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "%ld", count);
+    }
+}
+
+static void print_json_string(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        if ((unsigned char)*s >= ' ') {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Throughput is taken from the median, in megapixels of the image per second
+static void print_stage(FILE* f, const char* name, double* ms, int n,
+                        double megapixels, bool first) {
+    qsort(ms, n, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += ms[i];
+    }
+    fprintf(f,
+            "%s\n        \"%s\": {\"median_ms\": %.3f, \"p10_ms\": %.3f, "
+            "\"p90_ms\": %.3f, \"p99_ms\": %.3f, \"min_ms\": %.3f, "
+            "\"max_ms\": %.3f, \"mean_ms\": %.3f, \"mp_per_s\": %.1f}",
+            first ? "" : ",", name, percentile(ms, n, 0.5),
+            percentile(ms, n, 0.1), percentile(ms, n, 0.9),
+            percentile(ms, n, 0.99), ms[0], ms[n - 1], sum / n,
+            megapixels * 1e3 / percentile(ms, n, 0.5));
+}
+
+// Sizes of the data the kernels run over, small enough to stay in the cache
+// so only the arithmetic is timed
+#define KERNEL_BLOCKS 4096
+#define KERNEL_ROW 4096
+// Passes over the data in each timed run
+#define KERNEL_PASSES 64
+
+typedef struct kernel_data {
+    // KERNEL_BLOCKS dequantized blocks, and the pixels they transform to
+    short* coeffs;
+    uint8_t* blocks;
+    // A row of KERNEL_ROW pixels to convert to RGB, step bytes apart
+    uint8_t *y, *cb, *cr;
+    uint8_t* rgb;
+    int step;
+    // Two rows of half as many chroma samples, upsampled to KERNEL_ROW
+    uint8_t *near_row, *far_row;
+    uint8_t* upsampled;
+} KernelData;
+
+static void idct_scalar(KernelData* d) {
+    for (int i = 0; i < KERNEL_BLOCKS; ++i) {
+        stbi__idct_block(d->blocks + i * 64, 8, d->coeffs + i * 64);
+    }
+}
+
+static void ycbcr_scalar(KernelData* d) {
+    stbi__YCbCr_to_RGB_row(d->rgb, d->y, d->cb, d->cr, KERNEL_ROW, d->step);
+}
+
+static void upsample_scalar(KernelData* d) {
+    stbi__resample_row_hv_2(d->upsampled, d->near_row, d->far_row,
+                            KERNEL_ROW / 2, 2);
+}
+
+#ifdef STBI_SSE2
+static void idct_sse2(KernelData* d) {
+    for (int i = 0; i < KERNEL_BLOCKS; ++i) {
+        stbi__idct_simd(d->blocks + i * 64, 8, d->coeffs + i * 64);
+    }
+}
+
+static void ycbcr_sse2(KernelData* d) {
+    stbi__YCbCr_to_RGB_simd(d->rgb, d->y, d->cb, d->cr, KERNEL_ROW, d->step);
+}
+
+static void upsample_sse2(KernelData* d) {
+    stbi__resample_row_hv_2_simd(d->upsampled, d->near_row, d->far_row,
+                                 KERNEL_ROW / 2, 2);
+}
+#endif
+
+#ifdef STBI_AVX2
+static void idct_avx2(KernelData* d) {
+    for (int i = 0; i < KERNEL_BLOCKS; i += 2) {
+        stbi__idct_avx2_x2(d->blocks + i * 64, 8, d->coeffs + i * 64,
+                           d->blocks + (i + 1) * 64, 8,
+                           d->coeffs + (i + 1) * 64);
+    }
+}
+
+static void ycbcr_avx2(KernelData* d) {
+    stbi__YCbCr_to_RGB_avx2(d->rgb, d->y, d->cb, d->cr, KERNEL_ROW, d->step);
+}
+#endif
+
+enum kernel_path {
+    PATH_SCALAR,
+    PATH_SSE2,
+    PATH_AVX2,
+};
+
+static const char* const path_names[] = {"scalar", "sse2", "avx2"};
+
+typedef struct kernel {
+    const char* name;
+    enum kernel_path path;
+    void (*run)(KernelData* d);
+    // Color conversion output layout, 0 for the other kernels
+    int step;
+    // Bytes of pixels one pass writes
+    size_t output_bytes;
+} Kernel;
+
+#define IDCT_BYTES (KERNEL_BLOCKS * 64)
+
+static const Kernel kernels[] = {
+    {"idct", PATH_SCALAR, idct_scalar, 0, IDCT_BYTES},
+    {"ycbcr_to_rgb", PATH_SCALAR, ycbcr_scalar, 3, KERNEL_ROW * 3},
+    {"ycbcr_to_rgba", PATH_SCALAR, ycbcr_scalar, 4, KERNEL_ROW * 4},
+    {"upsample_hv_2", PATH_SCALAR, upsample_scalar, 0, KERNEL_ROW},
+#ifdef STBI_SSE2
+    {"idct", PATH_SSE2, idct_sse2, 0, IDCT_BYTES},
+    {"ycbcr_to_rgb", PATH_SSE2, ycbcr_sse2, 3, KERNEL_ROW * 3},
+    {"ycbcr_to_rgba", PATH_SSE2, ycbcr_sse2, 4, KERNEL_ROW * 4},
+    {"upsample_hv_2", PATH_SSE2, upsample_sse2, 0, KERNEL_ROW},
+#endif
+#ifdef STBI_AVX2
+    {"idct", PATH_AVX2, idct_avx2, 0, IDCT_BYTES},
+    {"ycbcr_to_rgb", PATH_AVX2, ycbcr_avx2, 3, KERNEL_ROW * 3},
+    {"ycbcr_to_rgba", PATH_AVX2, ycbcr_avx2, 4, KERNEL_ROW * 4},
+#endif
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(*kernels))
+
+static bool kernel_path_available(enum kernel_path path) {
+    switch (path) {
+#ifdef STBI_SSE2
+    case PATH_SSE2:
+        return stbi__sse2_available();
+#endif
+#ifdef STBI_AVX2
+    case PATH_AVX2:
+        return stbi__avx2_available();
+#endif
+    default:
+        return path == PATH_SCALAR;
+    }
+}
+
+static bool kernel_data_init(KernelData* d) {
+    // The SIMD kernels may read and write a few bytes past the end of a row
+    const size_t padding = 32;
+    d->coeffs = malloc(KERNEL_BLOCKS * 64 * sizeof(short));
+    d->blocks = malloc(KERNEL_BLOCKS * 64);
+    d->y = malloc(KERNEL_ROW + padding);
+    d->cb = malloc(KERNEL_ROW + padding);
+    d->cr = malloc(KERNEL_ROW + padding);
+    d->rgb = malloc(KERNEL_ROW * 4 + padding);
+    d->near_row = malloc(KERNEL_ROW / 2 + padding);
+    d->far_row = malloc(KERNEL_ROW / 2 + padding);
+    d->upsampled = malloc(KERNEL_ROW + padding);
+    if (!d->coeffs || !d->blocks || !d->y || !d->cb || !d->cr || !d->rgb ||
+        !d->near_row || !d->far_row || !d->upsampled) {
+        return false;
+    }
+
+    // Like a photo: a DC term and a few small low frequency terms, the rest
+    // quantized away
+    uint32_t state = 0x9e3779b9u;
+    for (int i = 0; i < KERNEL_BLOCKS * 64; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const int k = i % 64;
+        const int row = k / 8, col = k % 8;
+        if (k == 0) {
+            d->coeffs[i] = (short)((int)(state % 1024) - 512);
+        } else if (row + col < 4 && state % 4 != 0) {
+            d->coeffs[i] = (short)((int)(state % 128) - 64);
+        } else {
+            d->coeffs[i] = 0;
+        }
+    }
+    for (int i = 0; i < KERNEL_ROW + (int)padding; ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        d->y[i] = state;
+        d->cb[i] = state >> 8;
+        d->cr[i] = state >> 16;
+        if (i < KERNEL_ROW / 2 + (int)padding) {
+            d->near_row[i] = state >> 24;
+            d->far_row[i] = state >> 4;
+        }
+    }
+    return true;
+}
+
+static void kernel_data_deinit(KernelData* d) {
+    free(d->coeffs);
+    free(d->blocks);
+    free(d->y);
+    free(d->cb);
+    free(d->cr);
+    free(d->rgb);
+    free(d->near_row);
+    free(d->far_row);
+    free(d->upsampled);
+}
+
+// Times every kernel the CPU can run and prints them as JSON, with the median
+// time of one pass and the megabytes of pixels written per second
+static bool bench_kernels(FILE* out, int runs) {
+    KernelData d;
+    const bool have_data = kernel_data_init(&d);
+    double* const ms = calloc(runs, sizeof(double));
+    if (ms == NULL || !have_data) {
+        FATAL_ERROR("malloc failed\n");
+        free(ms);
+        kernel_data_deinit(&d);
+        return false;
+    }
+    fprintf(out, "{\n  \"runs\": %d,\n  \"kernels\": [", runs);
+    bool first = true;
+    for (int i = 0; i < NUM_KERNELS; ++i) {
+        const Kernel* const kernel = &kernels[i];
+        if (!kernel_path_available(kernel->path)) {
+            continue;
+        }
+        d.step = kernel->step;
+        // Once to warm up the cache
+        kernel->run(&d);
+        for (int run = 0; run < runs; ++run) {
+            const double t = get_time_ms();
+            for (int pass = 0; pass < KERNEL_PASSES; ++pass) {
+                kernel->run(&d);
+            }
+            ms[run] = (get_time_ms() - t) / KERNEL_PASSES;
+        }
+        qsort(ms, runs, sizeof(double), compare_doubles);
+        const double median = percentile(ms, runs, 0.5);
+        fprintf(out,
+                "%s\n    {\"kernel\": \"%s\", \"path\": \"%s\", "
+                "\"median_ms\": %.4f, \"mb_per_s\": %.1f}",
+                first ? "" : ",", kernel->name, path_names[kernel->path],
+                median, kernel->output_bytes * 1e-3 / median);
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+    free(ms);
+    kernel_data_deinit(&d);
+    return true;
+}
+
+typedef struct bench_case {
+    const char* format;
+    double megapixels;
+    int w, h;
+    // Channels the file was written with, and the ones it decodes to
+    int source_c, c;
+    size_t encoded_bytes;
+    // From the last run
+    IoCounts decode_io, decode_mmap_io;
+    double* ms[NUM_STAGES];
+} BenchCase;
+
+// Runs one file through every stage runs times. gl is NULL without a context.
+static bool run_case(BenchCase* bc, const char* path, int runs, GLState* gl) {
+    for (int run = 0; run < runs; ++run) {
+        IoCounts io = get_io_counts();
+        double t = get_time_ms();
+        Image image;
+        image.data = stbi_load(path, &image.w, &image.h, &image.c, 0);
+        if (image.data == NULL) {
+            FATAL_ERROR("failed to load %s: %s\n", path,
+                        stbi_failure_reason());
+            return false;
+        }
+        bc->ms[STAGE_DECODE][run] = get_time_ms() - t;
+        bc->decode_io = get_io_counts_since(io);
+        bc->c = image.c;
+
+        // Like the viewer's loader, falling back to stbi_load where the file
+        // can't be mapped
+        io = get_io_counts();
+        t = get_time_ms();
+        MappedFile file;
+        Image mapped;
+        if (map_file(path, &file)) {
+            mapped.data = stbi_load_from_memory(file.data, file.size,
+                                                &mapped.w, &mapped.h,
+                                                &mapped.c, 0);
+            unmap_file(&file);
+        } else {
+            mapped.data = stbi_load(path, &mapped.w, &mapped.h, &mapped.c, 0);
+        }
+        bc->ms[STAGE_DECODE_MMAP][run] = get_time_ms() - t;
+        bc->decode_mmap_io = get_io_counts_since(io);
+        if (mapped.data == NULL) {
+            FATAL_ERROR("failed to load %s from memory: %s\n", path,
+                        stbi_failure_reason());
+            stbi_image_free(image.data);
+            return false;
+        }
+        stbi_image_free(mapped.data);
+
+        const size_t size = (size_t)image.w * image.h * image.c;
+        uint8_t* const result = malloc(size);
+        if (result == NULL) {
+            FATAL_ERROR("failed to allocate %zu bytes\n", size);
+            stbi_image_free(image.data);
+            return false;
+        }
+
+        if (gl) {
+            t = get_time_ms();
+            if (!texture_upload_start(&gl->upload, &gl->source,
+                                      bpp_to_gl_image_format(image.c),
+                                      &image)) {
+                free(result);
+                stbi_image_free(image.data);
+                return false;
+            }
+            while (!texture_upload_step(&gl->upload)) {
+            }
+            glFinish();
+            bc->ms[STAGE_UPLOAD][run] = get_time_ms() - t;
+
+            // Allocating the target is part of the upload in the viewer
+            if (!setup_target_tiles(&gl->target, &gl->source, gl->fbo)) {
+                free(result);
+                stbi_image_free(image.data);
+                return false;
+            }
+            glFinish();
+            t = get_time_ms();
+            apply_contrast(&gl->source, &gl->target, gl->fbo,
+                           gl->image_shader, gl->quad.vao, BENCH_CONTRAST);
+            glFinish();
+            bc->ms[STAGE_CONTRAST][run] = get_time_ms() - t;
+
+            t = get_time_ms();
+            read_tiles(&gl->target, image.c, gl->fbo, result);
+            bc->ms[STAGE_READBACK][run] = get_time_ms() - t;
+        }
+
+        t = get_time_ms();
+        adjust_contrast(image.data, (size_t)image.w * image.h, image.c,
+                        BENCH_CONTRAST);
+        bc->ms[STAGE_CONTRAST_CPU][run] = get_time_ms() - t;
+
+        // Encodes into memory, so the disk isn't timed
+        size_t encoded = 0;
+        t = get_time_ms();
+        stbi_write_jpg_to_func(count_bytes, &encoded, image.w, image.h,
+                               image.c, gl ? result : image.data, 100);
+        bc->ms[STAGE_ENCODE][run] = get_time_ms() - t;
+        bc->encoded_bytes = encoded;
+
+        free(result);
+        stbi_image_free(image.data);
+    }
+    return true;
+}
+
+static int parse_list(const char* s, double* values) {
+    int n = 0;
+    while (*s && n < MAX_LIST) {
+        char* end;
+        values[n] = strtod(s, &end);
+        if (end == s || values[n] <= 0) {
+            return 0;
+        }
+        ++n;
+        s = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return 0;
+        }
+    }
+    return n;
+}
+
+static int parse_formats(char* s, const char** formats) {
+    int n = 0;
+    for (char* f = strtok(s, ","); f && n < MAX_LIST; f = strtok(NULL, ",")) {
+        if (strcmp(f, "jpg") != 0 && strcmp(f, "png") != 0 &&
+            strcmp(f, "hdr") != 0) {
+            return 0;
+        }
+        formats[n++] = f;
+    }
+    return n;
+}
+
+// Lets stb_image and stb_image_write split big images across the pool
+static void parallel_for_callback(void* pool, stbi_parallel_task* task,
+                                  void* data, int count) {
+    thread_pool_parallel_for(pool, task, data, count);
+}
+
+int main(int argc, char** argv) {
+    double sizes[MAX_LIST] = {1, 4, 16};
+    int num_sizes = 3;
+    double channels[MAX_LIST] = {1, 3, 4};
+    int num_channels = 3;
+    char default_formats[] = "jpg,png,hdr";
+    const char* formats[MAX_LIST];
+    int num_formats = parse_formats(default_formats, formats);
+    int runs = 5;
+    int num_threads = get_num_cpus();
+    const char* corpus_dir = ".";
+    const char* out_path = NULL;
+    bool time_kernels = false;
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        bool ok = has_value;
+        if (strcmp(argv[i], "--kernels") == 0) {
+            time_kernels = true;
+            ok = true;
+        } else if (strcmp(argv[i], "--sizes") == 0 && has_value) {
+            ok = (num_sizes = parse_list(argv[++i], sizes)) > 0;
+        } else if (strcmp(argv[i], "--channels") == 0 && has_value) {
+            ok = (num_channels = parse_list(argv[++i], channels)) > 0;
+            for (int j = 0; j < num_channels; ++j) {
+                ok = ok && (channels[j] == 1 || channels[j] == 3 ||
+                            channels[j] == 4);
+            }
+        } else if (strcmp(argv[i], "--formats") == 0 && has_value) {
+            ok = (num_formats = parse_formats(argv[++i], formats)) > 0;
+        } else if (strcmp(argv[i], "--runs") == 0 && has_value) {
+            runs = atoi(argv[++i]);
+            ok = runs > 0;
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            num_threads = atoi(argv[++i]);
+            ok = num_threads > 0;
+        } else if (strcmp(argv[i], "--corpus") == 0 && has_value) {
+            corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+            out_path = argv[++i];
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            FATAL_ERROR("invalid argument %s\n" BENCH_USAGE, argv[i]);
+            return 1;
+        }
+    }
+
+    if (time_kernels) {
+        FILE* const out = out_path ? fopen(out_path, "w") : stdout;
+        if (out == NULL) {
+            FATAL_ERROR("failed to open %s\n", out_path);
+            return 1;
+        }
+        const bool ok = bench_kernels(out, runs);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return ok ? 0 : 1;
+    }
+
+    ThreadPool pool;
+    const bool have_pool =
+        num_threads > 1 && thread_pool_init(&pool, num_threads - 1);
+    if (have_pool) {
+        stbi_set_parallel_for(parallel_for_callback, &pool);
+        stbi_write_set_parallel_for(parallel_for_callback, &pool);
+    }
+
+    GLState gl_state;
+    GLState* const gl = gl_state_init(&gl_state) ? &gl_state : NULL;
+    if (gl == NULL) {
+        FATAL_ERROR("no GL context, only timing the CPU stages\n");
+    }
+
+    FILE* const out = out_path ? fopen(out_path, "w") : stdout;
+    if (out == NULL) {
+        FATAL_ERROR("failed to open %s\n", out_path);
+        return 1;
+    }
+    fprintf(out, "{\n  \"renderer\": ");
+    print_json_string(out,
+                      gl ? (const char*)glGetString(GL_RENDERER) : "none");
+    fprintf(out, ",\n  \"threads\": %d,\n  \"runs\": %d,\n  \"cases\": [",
+            num_threads, runs);
+
+    bool ok = true;
+    bool first_case = true;
+    for (int si = 0; si < num_sizes && ok; ++si) {
+        // 4:3, the most common shape for photos
+        const double pixels = sizes[si] * 1e6;
+        const int w = (int)(sqrt(pixels * 4 / 3) + 0.5);
+        const int h = (int)(pixels / w + 0.5);
+        for (int ci = 0; ci < num_channels && ok; ++ci) {
+            const int c = (int)channels[ci];
+            uint8_t* source = NULL;
+            for (int fi = 0; fi < num_formats && ok; ++fi) {
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/ivac_bench_%gmp_c%d.%s",
+                         corpus_dir, sizes[si], c, formats[fi]);
+                // The corpus is deterministic, so files are kept between runs
+                int info_w, info_h, info_c;
+                if (!stbi_info(path, &info_w, &info_h, &info_c)) {
+                    fprintf(stderr, "Generating %s\n", path);
+                    if (source == NULL) {
+                        source = make_image(w, h, c);
+                    }
+                    if (source == NULL ||
+                        !write_corpus_file(path, formats[fi], w, h, c,
+                                           source)) {
+                        FATAL_ERROR("failed to generate %s\n", path);
+                        ok = false;
+                        break;
+                    }
+                }
+
+                fprintf(stderr, "Timing %s\n", path);
+                BenchCase bc = {
+                    .format = formats[fi],
+                    .megapixels = sizes[si],
+                    .w = w,
+                    .h = h,
+                    .source_c = c,
+                };
+                for (int i = 0; i < NUM_STAGES; ++i) {
+                    bc.ms[i] = calloc(runs, sizeof(double));
+                    ok = ok && bc.ms[i] != NULL;
+                }
+                ok = ok && run_case(&bc, path, runs, gl);
+                if (ok) {
+                    fprintf(out,
+                            "%s\n    {\"format\": \"%s\", \"megapixels\": %g, "
+                            "\"width\": %d, \"height\": %d, "
+                            "\"source_channels\": %d, \"channels\": %d, "
+                            "\"encoded_bytes\": %zu, ",
+                            first_case ? "" : ",", bc.format, bc.megapixels,
+                            bc.w, bc.h, bc.source_c, bc.c, bc.encoded_bytes);
+                    fprintf(out, "\"read_syscalls\": {\"decode\": ");
+                    print_json_count(out, bc.decode_io.reads);
+                    fprintf(out, ", \"decode_mmap\": ");
+                    print_json_count(out, bc.decode_mmap_io.reads);
+                    fprintf(out, "}, \"page_faults\": {\"decode\": ");
+                    print_json_count(out, bc.decode_io.page_faults);
+                    fprintf(out, ", \"decode_mmap\": ");
+                    print_json_count(out, bc.decode_mmap_io.page_faults);
+                    fprintf(out, "}, \"stages\": {");
+                    bool first_stage = true;
+                    for (int i = 0; i < NUM_STAGES; ++i) {
+                        if (stage_needs_gl[i] && gl == NULL) {
+                            continue;
+                        }
+                        print_stage(out, stage_names[i], bc.ms[i], runs,
+                                    (double)bc.w * bc.h * 1e-6, first_stage);
+                        first_stage = false;
+                    }
+                    fprintf(out, "\n      }}");
+                    first_case = false;
+                }
+                for (int i = 0; i < NUM_STAGES; ++i) {
+                    free(bc.ms[i]);
+                }
+            }
+            free(source);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (gl) {
+        gl_state_deinit(gl);
+    }
+    if (have_pool) {
+        stbi_set_parallel_for(NULL, NULL);
+        stbi_write_set_parallel_for(NULL, NULL);
+        thread_pool_deinit(&pool);
+    }
+    return ok ? 0 : 1;
+}
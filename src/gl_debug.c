@@ -0,0 +1,53 @@
+#include "gl_debug.h"
+
+#include "shader.h"
+
+_Atomic(const GlCallSite*) gl_recent_calls[GL_RECENT_CALLS];
+atomic_uint gl_next_call;
+
+// Prints the calls recorded before the message, oldest first. With
+// synchronous output the last one is the call that caused it.
+static void print_recent_calls(void) {
+    const unsigned next =
+        atomic_load_explicit(&gl_next_call, memory_order_relaxed);
+    fprintf(stderr, "Recent GL calls, most recent last:\n");
+    for (unsigned i = next - GL_RECENT_CALLS; i != next; ++i) {
+        const GlCallSite* const site = atomic_load_explicit(
+            &gl_recent_calls[i % GL_RECENT_CALLS], memory_order_relaxed);
+        if (site) {
+            fprintf(stderr, "    %s:%d %s\n", site->file, site->line,
+                    site->call);
+        }
+    }
+}
+
+static void GL_APIENTRY message_callback(GLenum source, GLenum type,
+                                         GLuint id, GLenum severity,
+                                         GLsizei length,
+                                         const GLchar* message,
+                                         const void* userParam) {
+    FATAL_ERROR(
+        "GL CALLBACK: %s source = 0x%x, type = 0x%x, severity = 0x%x, "
+        "message = %s\n",
+        (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), source, type,
+        severity, message);
+    if (type == GL_DEBUG_TYPE_ERROR) {
+        print_recent_calls();
+    }
+}
+
+void gl_debug_init(void) {
+    GLDEBUG(glEnable(GL_DEBUG_OUTPUT));
+#ifndef NDEBUG
+    GLDEBUG(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+#else
+    GLDEBUG(glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE,
+                                  GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL,
+                                  GL_FALSE));
+#endif
+    GLDEBUG(glDebugMessageCallback(message_callback, NULL));
+}
+
+void gl_debug_label(GLenum identifier, GLuint name, const char* label) {
+    GLDEBUG(glObjectLabel(identifier, name, -1, label));
+}
@@ -0,0 +1,70 @@
+#ifndef IVAC_SRC_GL_DEBUG_H_Q5NB8XRC
+#define IVAC_SRC_GL_DEBUG_H_Q5NB8XRC
+
+#include "gl_core_4_3.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// GL calls remembered for debug messages, to show what led up to them
+#define GL_RECENT_CALLS 16
+
+// A GL call wrapped in GLDEBUG, and where it's made
+typedef struct gl_call_site {
+    const char* call;
+    const char* file;
+    int line;
+} GlCallSite;
+
+// The last GL_RECENT_CALLS calls made through GLDEBUG, the oldest at
+// gl_next_call. Only the thread making GL calls writes these, but the debug
+// callback may read them from one of the driver's threads.
+extern _Atomic(const GlCallSite*) gl_recent_calls[GL_RECENT_CALLS];
+extern atomic_uint gl_next_call;
+
+static inline void gl_debug_record(const GlCallSite* site) {
+    const unsigned i =
+        atomic_load_explicit(&gl_next_call, memory_order_relaxed);
+    atomic_store_explicit(&gl_recent_calls[i % GL_RECENT_CALLS], site,
+                          memory_order_relaxed);
+    atomic_store_explicit(&gl_next_call, i + 1, memory_order_relaxed);
+}
+
+// Wraps every GL call so the debug callback can tell where it came from.
+// Debug builds also check glGetError after each call, which is a round trip
+// to the driver and a sync point on some of them, so release builds leave
+// errors to the debug callback alone.
+#ifndef NDEBUG
+#define GLDEBUG(x)                                                             \
+    do {                                                                       \
+        static const GlCallSite gl_call_site = {#x, __FILE__, __LINE__};       \
+        gl_debug_record(&gl_call_site);                                        \
+        x;                                                                     \
+        GLenum e;                                                              \
+        if ((e = glGetError()) != GL_NO_ERROR) {                               \
+            printf("glError 0x%x at %s line %d\n", e, __FILE__, __LINE__);     \
+            assert(false);                                                     \
+        }                                                                      \
+    } while (0)
+#else
+#define GLDEBUG(x)                                                             \
+    do {                                                                       \
+        static const GlCallSite gl_call_site = {#x, __FILE__, __LINE__};       \
+        gl_debug_record(&gl_call_site);                                        \
+        x;                                                                     \
+    } while (0)
+#endif
+
+// Prints the current context's debug messages, along with the calls leading
+// up to errors. Debug builds get them synchronously, from inside the call
+// that caused them. Release builds let the driver report them whenever it
+// likes and skip notifications.
+void gl_debug_init(void);
+
+// Names an object in debug messages and GL debuggers. identifier is the kind
+// of object, like GL_TEXTURE or GL_BUFFER.
+void gl_debug_label(GLenum identifier, GLuint name, const char* label);
+
+#endif /* IVAC_SRC_GL_DEBUG_H_Q5NB8XRC */
@@ -0,0 +1,132 @@
+#include "headless.h"
+
+#include "shader.h"
+
+#ifdef IVAC_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <string.h>
+
+static bool has_extension(const char* extensions, const char* name) {
+    const size_t len = strlen(name);
+    for (const char* p = extensions; p && (p = strstr(p, name)); p += len) {
+        if ((p == extensions || p[-1] == ' ') &&
+            (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static EGLDisplay get_display(void) {
+    // Client extensions can only be queried without a display
+    const char* const extensions =
+        eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (has_extension(extensions, "EGL_MESA_platform_surfaceless") &&
+        has_extension(extensions, "EGL_EXT_platform_base")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+                "eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            EGLDisplay display = get_platform_display(
+                EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (display != EGL_NO_DISPLAY) {
+                return display;
+            }
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool headless_context_init(HeadlessContext* ctx) {
+    ctx->display = NULL;
+    ctx->context = NULL;
+
+    EGLDisplay display = get_display();
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        FATAL_ERROR("failed to initialize EGL: 0x%x\n", eglGetError());
+        return false;
+    }
+    // Without a surface the context is only ever made current on its own
+    if (!has_extension(eglQueryString(display, EGL_EXTENSIONS),
+                       "EGL_KHR_surfaceless_context")) {
+        FATAL_ERROR("EGL_KHR_surfaceless_context is not supported\n");
+        eglTerminate(display);
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        FATAL_ERROR("EGL doesn't support desktop OpenGL\n");
+        eglTerminate(display);
+        return false;
+    }
+
+    // Configs default to needing window surfaces, which there aren't any of
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint num_configs;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) ||
+        num_configs < 1) {
+        FATAL_ERROR("no EGL config supports OpenGL\n");
+        eglTerminate(display);
+        return false;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+#ifndef NDEBUG
+        EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+        EGL_NONE,
+    };
+    EGLContext context =
+        eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT) {
+        FATAL_ERROR("failed to create an OpenGL 4.3 context: 0x%x\n",
+                    eglGetError());
+        eglTerminate(display);
+        return false;
+    }
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        FATAL_ERROR("failed to make the EGL context current: 0x%x\n",
+                    eglGetError());
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+    ctx->display = display;
+    ctx->context = context;
+    return true;
+}
+
+void headless_context_deinit(HeadlessContext* ctx) {
+    if (ctx->display == NULL) {
+        return;
+    }
+    eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+    eglDestroyContext(ctx->display, ctx->context);
+    eglTerminate(ctx->display);
+    ctx->display = NULL;
+    ctx->context = NULL;
+}
+
+#else
+
+bool headless_context_init(HeadlessContext* ctx) {
+    ctx->display = NULL;
+    ctx->context = NULL;
+    FATAL_ERROR("ivac was built without EGL, headless rendering is "
+                "unavailable\n");
+    return false;
+}
+
+void headless_context_deinit(HeadlessContext* ctx) {}
+
+#endif
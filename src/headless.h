@@ -0,0 +1,21 @@
+#ifndef IVAC_SRC_HEADLESS_H_XB4RM2QE
+#define IVAC_SRC_HEADLESS_H_XB4RM2QE
+
+#include <stdbool.h>
+
+// A GL 4.3 core context with no window or display behind it, so the same
+// passes the viewer runs can be used on servers. Goes through EGL's
+// surfaceless platform (Mesa, which falls back to llvmpipe without a GPU), or
+// the default EGL display if that isn't available. Everything is rendered into
+// framebuffer objects, there's no default framebuffer.
+typedef struct headless_context {
+    void* display;
+    void* context;
+} HeadlessContext;
+
+// Creates the context and makes it current on the calling thread. Fails if
+// ivac was built without EGL.
+bool headless_context_init(HeadlessContext* ctx);
+void headless_context_deinit(HeadlessContext* ctx);
+
+#endif /* IVAC_SRC_HEADLESS_H_XB4RM2QE */
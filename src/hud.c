@@ -0,0 +1,88 @@
+#include "hud.h"
+
+#include "shader.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// Sizes in pixels. Each sample is a bar HUD_BAR_WIDTH wide.
+#define HUD_BAR_WIDTH 2
+#define HUD_GRAPH_HEIGHT 40
+#define HUD_MARGIN 8
+// Milliseconds at the top of a graph, and of the reference line
+#define HUD_MAX_MS 33.3f
+#define HUD_LINE_MS 16.7f
+
+// Same layout as the GUI's instances: two opposite corners, then the color
+struct hud_instance {
+    float bounds[4];
+    float color[3];
+};
+
+// A background and a reference line per graph, then a bar per sample
+#define HUD_MAX_INSTANCES (HUD_MAX_GRAPHS * (2 + TIMER_HISTORY))
+
+void hud_init(Hud* hud) {
+    const GLenum types[2] = {GL_FLOAT, GL_FLOAT};
+    const uint8_t counts[2] = {4, 3};
+    vertex_object_init(&hud->vo, 2, types, counts);
+    vertex_object_set_instanced(&hud->vo, 2);
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, hud->vo.vbo));
+    GLDEBUG(glBufferData(GL_ARRAY_BUFFER,
+                         sizeof(struct hud_instance) * HUD_MAX_INSTANCES, NULL,
+                         GL_DYNAMIC_DRAW));
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+void hud_deinit(Hud* hud) { vertex_object_deinit(&hud->vo); }
+
+// Adds a quad covering pixels x0..x1 and y0..y1, counting up from the bottom
+// left corner
+static void add_quad(struct hud_instance* instance, float x0, float y0,
+                     float x1, float y1, const float color[3], float vw,
+                     float vh) {
+    instance->bounds[0] = x0 / vw * 2 - 1;
+    instance->bounds[1] = y0 / vh * 2 - 1;
+    instance->bounds[2] = x1 / vw * 2 - 1;
+    instance->bounds[3] = y1 / vh * 2 - 1;
+    memcpy(instance->color, color, sizeof(instance->color));
+}
+
+void hud_draw(Hud* hud, GLuint gui_shader, const HudGraph* graphs,
+              int num_graphs, float viewport_w, float viewport_h) {
+    static struct hud_instance instances[HUD_MAX_INSTANCES];
+    const float background[3] = {0.1f, 0.1f, 0.1f};
+    const float line[3] = {0.5f, 0.5f, 0.5f};
+    const float width = TIMER_HISTORY * HUD_BAR_WIDTH;
+    assert(num_graphs <= HUD_MAX_GRAPHS);
+
+    int count = 0;
+    for (int g = 0; g < num_graphs; ++g) {
+        const TimerHistory* const history = graphs[g].history;
+        const float x0 = HUD_MARGIN;
+        const float y0 = HUD_MARGIN + g * (HUD_GRAPH_HEIGHT + HUD_MARGIN);
+        add_quad(&instances[count++], x0, y0, x0 + width,
+                 y0 + HUD_GRAPH_HEIGHT, background, viewport_w, viewport_h);
+        // Newest samples on the right
+        for (int i = 0; i < history->count; ++i) {
+            float ms = timer_history_get(history, i);
+            ms = ms < HUD_MAX_MS ? ms : HUD_MAX_MS;
+            const float x = x0 + width - (history->count - i) * HUD_BAR_WIDTH;
+            add_quad(&instances[count++], x, y0, x + HUD_BAR_WIDTH,
+                     y0 + ms / HUD_MAX_MS * HUD_GRAPH_HEIGHT, graphs[g].color,
+                     viewport_w, viewport_h);
+        }
+        const float line_y = y0 + HUD_LINE_MS / HUD_MAX_MS * HUD_GRAPH_HEIGHT;
+        add_quad(&instances[count++], x0, line_y, x0 + width, line_y + 1, line,
+                 viewport_w, viewport_h);
+    }
+
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, hud->vo.vbo));
+    GLDEBUG(glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(*instances) * count,
+                            instances));
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    GLDEBUG(glUseProgram(gui_shader));
+    GLDEBUG(glBindVertexArray(hud->vo.vao));
+    GLDEBUG(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count));
+}
@@ -0,0 +1,30 @@
+#ifndef IVAC_SRC_HUD_H_Q9DKW4CY
+#define IVAC_SRC_HUD_H_Q9DKW4CY
+
+#include "gl_core_4_3.h"
+#include "timers.h"
+#include "vertex_object.h"
+
+// Graphs drawn at most
+#define HUD_MAX_GRAPHS 8
+
+typedef struct hud_graph {
+    const TimerHistory* history;
+    float color[3];
+} HudGraph;
+
+// Rolling frame time graphs in the bottom left corner of the window, one per
+// timer, stacked from the bottom. Each is drawn as instanced quads through
+// the GUI shader, with a line at 16.7 ms and the bars capped at twice that.
+typedef struct hud {
+    VertexObject vo;
+} Hud;
+
+void hud_init(Hud* hud);
+void hud_deinit(Hud* hud);
+
+// Draws num_graphs graphs with gui_shader on a viewport_w x viewport_h window
+void hud_draw(Hud* hud, GLuint gui_shader, const HudGraph* graphs,
+              int num_graphs, float viewport_w, float viewport_h);
+
+#endif /* IVAC_SRC_HUD_H_Q9DKW4CY */
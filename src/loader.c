@@ -0,0 +1,170 @@
+#include "loader.h"
+
+#include "shader.h"
+#include "stb_image.h"
+#include "trace.h"
+
+#include <limits.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool map_file(const char* path, MappedFile* file) {
+#ifndef _WIN32
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        st.st_size > INT_MAX) {
+        close(fd);
+        return false;
+    }
+    file->size = st.st_size;
+    // MAP_PRIVATE read-only pages are shared with the page cache, so opening
+    // the same file again doesn't read it from disk
+    void* const mem = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    // The decoders read the file front to back, so have the kernel read ahead
+    // aggressively and start faulting pages in right away
+    madvise(mem, file->size, MADV_SEQUENTIAL);
+    madvise(mem, file->size, MADV_WILLNEED);
+    file->data = mem;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void unmap_file(MappedFile* file) {
+#ifndef _WIN32
+    munmap((void*)file->data, file->size);
+#endif
+}
+
+static bool is_jpeg(const MappedFile* file) {
+    return file->size > 2 && file->data[0] == 0xff && file->data[1] == 0xd8;
+}
+
+static void decode(const MappedFile* file, Image* image) {
+    image->data = stbi_load_from_memory(file->data, file->size, &image->w,
+                                        &image->h, &image->c, 0);
+}
+
+static void notify(ImageLoader* loader) {
+    if (loader->notify) {
+        loader->notify();
+    }
+}
+
+// Even a reduced size decode still entropy decodes the whole file, so the
+// preview runs next to the full decode rather than ahead of it
+static void* preview_thread(void* arg) {
+    ImageLoader* loader = arg;
+    trace_thread_name("preview loader");
+    Image preview;
+    stbi_set_jpeg_scale_on_load_thread(loader->preview_denom);
+    TRACE_BEGIN("decode preview");
+    decode(&loader->file, &preview);
+    TRACE_END();
+    if (preview.data == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&loader->mutex);
+    const bool wanted = atomic_load(&loader->stage) == LOADER_DECODING;
+    if (wanted) {
+        loader->preview = preview;
+        atomic_store(&loader->stage, LOADER_PREVIEW_READY);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    if (wanted) {
+        notify(loader);
+    } else {
+        stbi_image_free(preview.data);
+    }
+    return NULL;
+}
+
+static void* decode_thread(void* arg) {
+    ImageLoader* loader = arg;
+    trace_thread_name("loader");
+    const bool mapped = map_file(loader->path, &loader->file);
+    if (!mapped) {
+        Image* const image = &loader->image;
+        TRACE_BEGIN("decode");
+        image->data =
+            stbi_load(loader->path, &image->w, &image->h, &image->c, 0);
+        TRACE_END();
+    } else {
+        // Only JPEGs can be decoded at a reduced size, for anything else the
+        // preview would cost as much as the real thing
+        if (loader->preview_denom > 1 && is_jpeg(&loader->file)) {
+            loader->has_preview_thread =
+                pthread_create(&loader->preview_thread, NULL, preview_thread,
+                               loader) == 0;
+        }
+        TRACE_BEGIN("decode");
+        decode(&loader->file, &loader->image);
+        TRACE_END();
+    }
+    if (loader->image.data == NULL) {
+        // The failure reason is thread local, so grab it here
+        loader->error = stbi_failure_reason();
+    }
+    pthread_mutex_lock(&loader->mutex);
+    atomic_store(&loader->stage, LOADER_DONE);
+    pthread_mutex_unlock(&loader->mutex);
+    notify(loader);
+
+    // The preview may still be reading the file
+    if (loader->has_preview_thread) {
+        pthread_join(loader->preview_thread, NULL);
+    }
+    if (mapped) {
+        unmap_file(&loader->file);
+    }
+    return NULL;
+}
+
+bool image_loader_start(ImageLoader* loader, const char* path,
+                        int preview_denom, void (*notify)(void)) {
+    loader->path = path;
+    loader->preview_denom = preview_denom;
+    loader->notify = notify;
+    loader->preview.data = NULL;
+    loader->image.data = NULL;
+    loader->error = NULL;
+    loader->joined = false;
+    loader->has_preview_thread = false;
+    pthread_mutex_init(&loader->mutex, NULL);
+    atomic_init(&loader->stage, LOADER_DECODING);
+
+    int err = pthread_create(&loader->thread, NULL, decode_thread, loader);
+    if (err != 0) {
+        FATAL_ERROR("failed to start decode thread: %d\n", err);
+        pthread_mutex_destroy(&loader->mutex);
+        return false;
+    }
+    return true;
+}
+
+enum loader_stage image_loader_stage(ImageLoader* loader) {
+    return atomic_load(&loader->stage);
+}
+
+void image_loader_join(ImageLoader* loader) {
+    if (!loader->joined) {
+        pthread_join(loader->thread, NULL);
+        pthread_mutex_destroy(&loader->mutex);
+        loader->joined = true;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef IVAC_SRC_LOADER_H_R3WQ7XPD
+#define IVAC_SRC_LOADER_H_R3WQ7XPD
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct image {
+    uint8_t* data;
+    int w, h, c;
+} Image;
+
+enum loader_stage {
+    LOADER_DECODING,
+    // A reduced size preview is available, the full image is still decoding
+    LOADER_PREVIEW_READY,
+    // The full image has finished decoding, successfully or not. A preview
+    // that finishes after this is thrown away.
+    LOADER_DONE,
+};
+
+typedef struct mapped_file {
+    const uint8_t* data;
+    size_t size;
+} MappedFile;
+
+// Decodes an image on a background thread so the window and GL state can be
+// created while stb_image is still working. A reduced size preview is decoded
+// on a second thread at the same time, as it costs most of a full decode.
+typedef struct image_loader {
+    pthread_t thread;
+    pthread_t preview_thread;
+    bool has_preview_thread;
+    const char* path;
+    // JPEGs are also decoded at 1/preview_denom of their size if this is > 1
+    int preview_denom;
+    // Called from the decode threads whenever the stage advances
+    void (*notify)(void);
+    // Shared by both decode threads
+    MappedFile file;
+
+    // Only valid once the stage is LOADER_PREVIEW_READY
+    Image preview;
+    // Only valid once the stage is LOADER_DONE
+    Image image;
+    const char* error;
+
+    // Held while advancing the stage, so a preview can't be stored after the
+    // full image is done
+    pthread_mutex_t mutex;
+    atomic_int stage;
+    bool joined;
+} ImageLoader;
+
+// Maps the file read-only so it can be decoded straight from memory instead of
+// going through stb_image's small stdio buffer. Returns false for anything that
+// can't be mapped (pipes, empty or huge files, Windows), in which case the
+// caller should fall back to stbi_load, which also keeps stb_image's error
+// messages for missing files.
+bool map_file(const char* path, MappedFile* file);
+void unmap_file(MappedFile* file);
+
+// Starts decoding path. notify may be NULL.
+bool image_loader_start(ImageLoader* loader, const char* path,
+                        int preview_denom, void (*notify)(void));
+enum loader_stage image_loader_stage(ImageLoader* loader);
+// Waits for the decode threads to exit, which may be a while after
+// LOADER_DONE if the preview was slower. Safe to call more than once.
+void image_loader_join(ImageLoader* loader);
+
+#endif /* IVAC_SRC_LOADER_H_R3WQ7XPD */
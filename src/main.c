@@ -1,19 +1,33 @@
 #include "gl_core_4_3.h"
 #include <GLFW/glfw3.h>
 
+#include "trace.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
+#define STBI_TRACE_BEGIN(name) TRACE_BEGIN(name)
+#define STBI_TRACE_END() TRACE_END()
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "batch.h"
 #include "gui.h"
+#include "hud.h"
+#include "loader.h"
+#include "pool.h"
+#include "render.h"
+#include "save.h"
 #include "shader.h"
+#include "tiles.h"
+#include "timers.h"
+#include "upload.h"
 #include "vertex_object.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 // Width and height of the window
 float viewport[2];
@@ -54,6 +68,16 @@ const struct widget widgets[NUM_WIDGETS] = {
     {get_handle_bounds, drag_handle, {0.4, 0.8, 1.0}},
 };
 
+// Per instance attributes of the GUI shader, be sure to update the vertex
+// object when editing these
+struct gui_instance {
+    // Screen positions of two opposite corners
+    float bounds[4];
+    float color[3];
+};
+// The widgets, plus the placeholder drawn before the image is loaded
+#define MAX_GUI_INSTANCES (NUM_WIDGETS + 1)
+
 static void pixel_to_gl_screen(float x, float y, float* _x, float* _y) {
     *_x = x / viewport[0] * 2 - 1;
     *_y = -(y / viewport[1] * 2 - 1);
@@ -97,6 +121,10 @@ static void mouse_button_callback(GLFWwindow* window, int button, int action,
                 }
             }
         } else if (action == GLFW_RELEASE) {
+            // Redraw to process the whole image with the final contrast
+            if (dragging_handle) {
+                dirty = true;
+            }
             dragging_handle = false;
         }
     }
@@ -120,105 +148,123 @@ static void mouse_motion_callback(GLFWwindow* window, double x, double y) {
     cursor_y = y;
 }
 
-static void error_callback(int code, const char* description) {
-    FATAL_ERROR("GLFW Error %d: %s\n", code, description);
+// Lets stb_image and stb_image_write split decoding and encoding across the
+// thread pool
+static void parallel_for_callback(void* pool, stbi_parallel_task* task,
+                                  void* data, int count) {
+    thread_pool_parallel_for(pool, task, data, count);
 }
 
-static void GLAPIENTRY message_callback(GLenum source, GLenum type, GLuint id,
-                                        GLenum severity, GLsizei length,
-                                        const GLchar* message,
-                                        const void* userParam) {
-    FATAL_ERROR(
-        "GL CALLBACK: %s source = 0x%x, type = 0x%x, severity = 0x%x, "
-        "message = %s\n",
-        (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), source, type,
-        severity, message);
+// Stops the pool's threads, after which stb_image and stb_image_write go back
+// to running on the calling thread
+static void stop_pool(ThreadPool* pool) {
+    stbi_set_parallel_for(NULL, NULL);
+    stbi_write_set_parallel_for(NULL, NULL);
+    thread_pool_deinit(pool);
 }
 
-static GLint bpp_to_gl_image_format(unsigned int bpp) {
-    switch (bpp) {
-    case 4: return GL_RGBA;
-    case 3: return GL_RGB;
-    case 2: return GL_RG;
-    case 1: return GL_ALPHA;
-    default: return GL_RGBA;
-    }
-}
-
-static void build_first_image_buffer(GLuint vbo) {
-    const float verts[4][4] = {
-        // xyuv
-        {-1, +1, 0, 1},
-        {-1, -1, 0, 0},
-        {+1, +1, 1, 1},
-        {+1, -1, 1, 0},
-    };
-    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));
-    GLDEBUG(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 16, verts,
-                         GL_DYNAMIC_DRAW));
-    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+static void error_callback(int code, const char* description) {
+    FATAL_ERROR("GLFW Error %d: %s\n", code, description);
 }
 
-static void build_image_buffer(int image_width, int image_height, GLuint vbo) {
-    float verts[4][4] = {
-        // xyuv
-        {-1, +1, 0, 1},
-        {-1, -1, 0, 0},
-        {+1, +1, 1, 1},
-        {+1, -1, 1, 0},
-    };
+// Converts a position on the image, from (0, 0) at the first pixel to (1, 1)
+// at the last, to where it's drawn on the screen
+static void image_to_gl_screen(int image_width, int image_height, float u,
+                               float v, float* _x, float* _y) {
     const float image_aspect = image_width / (float)image_height;
     const float viewport_aspect = viewport[0] / viewport[1];
     const float aspect_diff = viewport_aspect - image_aspect;
 
-    for (int i = 0; i < 4; ++i) {
-        verts[i][0] *= zoom;
-        verts[i][1] *= zoom;
+    float x = (u * 2 - 1) * zoom + scroll_x;
+    float y = (v * 2 - 1) * zoom + scroll_y;
+    if (aspect_diff > 0) {
+        x *= image_aspect / viewport_aspect;
+    } else if (aspect_diff < 0) {
+        y *= 1 / image_aspect * viewport_aspect;
+    }
+    *_x = x;
+    *_y = y;
+}
 
-        verts[i][0] += scroll_x;
-        verts[i][1] += scroll_y;
+// Gets the screen positions of the image's first and last corners
+static void get_image_bounds(int image_width, int image_height,
+                             float bounds[4]) {
+    image_to_gl_screen(image_width, image_height, 0, 0, &bounds[0],
+                       &bounds[1]);
+    image_to_gl_screen(image_width, image_height, 1, 1, &bounds[2],
+                       &bounds[3]);
+}
 
-        if (aspect_diff > 0) {
-            verts[i][0] *= image_aspect / viewport_aspect;
-        } else if (aspect_diff < 0) {
-            verts[i][1] *= 1 / image_aspect * viewport_aspect;
-        }
+// Gets where tile i is drawn on the screen and the texture coordinates of its
+// own part of its texture. Returns false if it's entirely off screen.
+static bool get_tile_bounds(int image_width, int image_height,
+                            const TileGrid* tiles, int i, float bounds[4],
+                            float uv_bounds[4]) {
+    TileRect content, stored;
+    tile_grid_get_rects(tiles, i, &content, &stored);
+    image_to_gl_screen(image_width, image_height, content.x / (float)tiles->w,
+                       content.y / (float)tiles->h, &bounds[0], &bounds[1]);
+    image_to_gl_screen(image_width, image_height,
+                       (content.x + content.w) / (float)tiles->w,
+                       (content.y + content.h) / (float)tiles->h, &bounds[2],
+                       &bounds[3]);
+    if (bounds[2] < -1 || bounds[0] > 1 || bounds[3] < -1 || bounds[1] > 1) {
+        return false;
     }
-    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));
-    GLDEBUG(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 16, verts,
-                         GL_DYNAMIC_DRAW));
-    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    // The border is just there to be filtered with
+    uv_bounds[0] = (content.x - stored.x) / (float)stored.w;
+    uv_bounds[1] = (content.y - stored.y) / (float)stored.h;
+    uv_bounds[2] = (content.x + content.w - stored.x) / (float)stored.w;
+    uv_bounds[3] = (content.y + content.h - stored.y) / (float)stored.h;
+    return true;
 }
 
-static void build_quad_buffer(GLuint vbo, Rect r) {
-    float x1, x2, y1, y2;
-    pixel_to_gl_screen(r.x, r.y, &x1, &y1);
-    pixel_to_gl_screen(r.x + r.w, r.y + r.h, &x2, &y2);
-
-    const float verts[4][2] = {
-        {x1, y1},
-        {x2, y1},
-        {x1, y2},
-        {x2, y2},
-    };
+// Gets the screen positions of a widget's corners
+static void get_widget_bounds(Rect r, float bounds[4]) {
+    pixel_to_gl_screen(r.x, r.y, &bounds[0], &bounds[1]);
+    pixel_to_gl_screen(r.x + r.w, r.y + r.h, &bounds[2], &bounds[3]);
+}
+
+// Fills vbo with the GUI instances to draw this frame, in the order they're
+// drawn in. Returns the number of instances.
+static int build_gui_buffer(int image_width, int image_height,
+                            bool placeholder, GLuint vbo) {
+    struct gui_instance instances[MAX_GUI_INSTANCES];
+    int count = 0;
+    if (placeholder) {
+        // Still decoding, fill the image's area with a placeholder
+        struct gui_instance* const instance = &instances[count++];
+        get_image_bounds(image_width, image_height, instance->bounds);
+        for (int i = 0; i < 3; ++i) {
+            instance->color[i] = 0.2;
+        }
+    }
+    for (int i = 0; i < NUM_WIDGETS; ++i) {
+        struct gui_instance* const instance = &instances[count++];
+        get_widget_bounds(widgets[i].get_bounds(), instance->bounds);
+        memcpy(instance->color, widgets[i].color, sizeof(instance->color));
+    }
+    // The buffer is allocated once for MAX_GUI_INSTANCES, only its contents
+    // change
     GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));
-    GLDEBUG(glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 8, verts,
-                         GL_DYNAMIC_DRAW));
+    GLDEBUG(glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(*instances) * count,
+                            instances));
     GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    return count;
 }
 
-static GLFWwindow* setup_glfw(int image_width, int image_height) {
+static bool init_glfw() {
     glfwSetErrorCallback(error_callback);
     if (glfwInit() != GLFW_TRUE) {
         FATAL_ERROR("failed to initalize GLFW\n");
-        return 0;
+        return false;
     }
+    return true;
+}
 
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
+// Sizes the window to fit the image, or the screen if the image is bigger
+static void init_viewport(int image_width, int image_height) {
     const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
 
     if (image_height > mode->height || image_width > mode->width) {
@@ -228,6 +274,29 @@ static GLFWwindow* setup_glfw(int image_width, int image_height) {
         viewport[0] = image_width;
         viewport[1] = image_height;
     }
+}
+
+// Picks the smallest JPEG decode scale that still covers the whole window, or
+// 1 if the image isn't big enough for a preview to be worth it
+static int get_preview_denom(int image_width, int image_height) {
+    for (int denom = 8; denom > 1; denom /= 2) {
+        if ((image_width + denom - 1) / denom >= viewport[0] &&
+            (image_height + denom - 1) / denom >= viewport[1]) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+static GLFWwindow* setup_glfw() {
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifndef NDEBUG
+    // Drivers may only check everything and report it all in debug contexts
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
 
     GLFWwindow* window =
         glfwCreateWindow(viewport[0], viewport[1],
@@ -241,24 +310,119 @@ static GLFWwindow* setup_glfw(int image_width, int image_height) {
     return window;
 }
 
-int main(const int argc, const char* const* const argv) {
-    if (argc != 2) {
-        FATAL_ERROR("expected 1 argument, got %d\n", argc - 1);
+// Where frame time goes. Only kept with the HUD or frame stats enabled.
+typedef struct frame_timers {
+    // The contrast pass including its mipmaps, and drawing to the window
+    GpuTimer contrast;
+    GpuTimer display;
+    // CPU time of each frame, not counting event handling
+    TimerHistory frame;
+    // Event handling, including the input callbacks GLFW runs from it. Only
+    // measured while polling, as waiting for events is mostly idle time.
+    TimerHistory events;
+    // CPU time of each upload step and GUI buffer rebuild
+    TimerHistory upload;
+    TimerHistory gui;
+} FrameTimers;
+
+static void frame_timers_init(FrameTimers* timers) {
+    gpu_timer_init(&timers->contrast);
+    gpu_timer_init(&timers->display);
+    timer_history_init(&timers->frame);
+    timer_history_init(&timers->events);
+    timer_history_init(&timers->upload);
+    timer_history_init(&timers->gui);
+}
+
+static void frame_timers_deinit(FrameTimers* timers) {
+    gpu_timer_deinit(&timers->contrast);
+    gpu_timer_deinit(&timers->display);
+}
+
+// Runs the contrast pass at the slider's setting. timers may be NULL.
+static void apply_slider_contrast(const TileGrid* source,
+                                  const TileGrid* target, GLuint fbo,
+                                  GLuint image_shader,
+                                  const VertexObject* quad,
+                                  FrameTimers* timers) {
+    if (timers) {
+        gpu_timer_begin(&timers->contrast);
+    }
+    apply_contrast(source, target, fbo, image_shader, quad->vao,
+                   1 - logf(contrast * 2));
+    // Sampled trilinearly from a mip chain, so zooming out neither aliases
+    // nor reads the whole image for every pixel on screen
+    TRACE_BEGIN("mipmaps");
+    tile_grid_generate_mipmaps(target);
+    TRACE_END();
+    if (timers) {
+        gpu_timer_end(&timers->contrast);
+    }
+}
+
+// Shows the image at path until the window is closed. Returns main's exit
+// code.
+static int run_viewer(const char* path) {
+    // Only read the header here so the window can be sized while the pixels
+    // are decoded in the background
+    int w, h, c;
+    if (!stbi_info(path, &w, &h, &c)) {
+        FATAL_ERROR("failed to load %s: %s\n", path, stbi_failure_reason());
         return -1;
     }
 
+    const char* save_path = getenv("IVAC_SAVE_PATH");
+    if (save_path == NULL) {
+        save_path = "out.jpg";
+    }
+
     stbi_set_flip_vertically_on_load(true);
     stbi_flip_vertically_on_write(true);
-    int w, h, c;
-    uint8_t* const data = stbi_load(argv[1], &w, &h, &c, 0);
-    if (data == NULL) {
-        FATAL_ERROR("failed to load %s: %s\n", argv[1], stbi_failure_reason());
+    // Lossless saves of big images would take seconds with the default
+    // settings
+    stbi_write_png_fast = true;
+    stbi_write_png_compression_level = 4;
+
+    // Decoding already splits up across the pool while the window is
+    // created, so every return from here on has to stop it again
+    ThreadPool pool;
+    const bool have_pool = thread_pool_init(&pool, 0);
+    if (have_pool) {
+        stbi_set_parallel_for(parallel_for_callback, &pool);
+        stbi_write_set_parallel_for(parallel_for_callback, &pool);
+    }
+
+    // GLFW has to be initialized before the decode thread can post an event
+    if (!init_glfw()) {
+        if (have_pool) {
+            stop_pool(&pool);
+        }
+        return -1;
+    }
+    init_viewport(w, h);
+    ImageLoader loader;
+    if (!image_loader_start(&loader, path, get_preview_denom(w, h),
+                            glfwPostEmptyEvent)) {
+        glfwTerminate();
+        if (have_pool) {
+            stop_pool(&pool);
+        }
         return -1;
     }
+    // Set once the preview or the full image has been uploaded
+    bool loaded = false;
+    // Set once the full resolution image has been uploaded
+    bool full_res = false;
 
-    GLFWwindow* const win = setup_glfw(w, h);
+    GLFWwindow* const win = setup_glfw();
     if (win == NULL) {
-        stbi_image_free(data);
+        // The decode thread may still be using the pool
+        image_loader_join(&loader);
+        stbi_image_free(loader.preview.data);
+        stbi_image_free(loader.image.data);
+        if (have_pool) {
+            stop_pool(&pool);
+        }
         return -1;
     }
 
@@ -270,121 +434,323 @@ int main(const int argc, const char* const* const argv) {
     printf("OpenGL %s GLSL %s\n", glGetString(GL_VERSION),
            glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-    GLDEBUG(glEnable(GL_DEBUG_OUTPUT));
-    GLDEBUG(glDebugMessageCallback(message_callback, 0));
+    gl_debug_init();
 
-    VertexObject image, gui;
+    VertexObject quad;
+    {
+        const GLenum types[1] = {GL_FLOAT};
+        const uint8_t counts[1] = {2};
+        vertex_object_init(&quad, 1, types, counts);
+    }
+    build_quad_buffer(quad.vbo);
+    VertexObject gui;
     {
         const GLenum types[2] = {GL_FLOAT, GL_FLOAT};
-        const uint8_t counts[2] = {2, 2};
-        vertex_object_init(&gui, 1, types, counts);
-        vertex_object_init(&image, 2, types, counts);
+        const uint8_t counts[2] = {4, 3};
+        vertex_object_init(&gui, 2, types, counts);
+        vertex_object_set_instanced(&gui, 2);
     }
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, gui.vbo));
+    GLDEBUG(glBufferData(GL_ARRAY_BUFFER,
+                         sizeof(struct gui_instance) * MAX_GUI_INSTANCES, NULL,
+                         GL_DYNAMIC_DRAW));
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
 
     const GLuint gui_shader = get_gui_shader();
     const GLuint image_shader = get_image_shader();
     const GLuint display_shader = get_display_shader();
 
-    GLuint tex[2];
-    GLDEBUG(glGenTextures(2, tex));
-
-    // Set original image texture data
-    GLDEBUG(glBindTexture(GL_TEXTURE_2D, tex[0]));
-    GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    GLint fmt = bpp_to_gl_image_format(c);
-    GLDEBUG(glTexImage2D(GL_TEXTURE_2D, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE,
-                         data));
-    stbi_image_free(data);
-
-    // Create the framebuffer object
+    // The uploaded image, and the image with the contrast applied
+    TileGrid tiles[2];
+    tile_grid_init(&tiles[0]);
+    tile_grid_init(&tiles[1]);
+    // Images are streamed into upload_tiles and then swapped into tiles[0], so
+    // the preview stays on screen until the full image is completely in
+    TileGrid upload_tiles;
+    tile_grid_init(&upload_tiles);
+    TextureUpload upload;
+    texture_upload_init(&upload);
+    // The image being uploaded, if any
+    Image* uploading = NULL;
+    // Without the writer thread the window is closed again straight away,
+    // through the same cleanup as a normal exit
+    ImageSaver saver;
+    const bool have_saver = image_saver_init(&saver, glfwPostEmptyEvent);
+    int ret = have_saver ? 0 : -1;
+    // Set while a save is still being read back from the GPU
+    bool reading_back = false;
+    // Contrast tiles[1] was last rendered with, or negative if it hasn't been
+    // rendered since the image was uploaded. Panning and zooming only redraw
+    // the screen from the existing tiles.
+    float processed_contrast = -1;
+    // Frames drawn, and how many of them had to re-run the contrast pass
+    unsigned long num_frames = 0;
+    unsigned long num_contrast_passes = 0;
     GLuint fbo;
     GLDEBUG(glGenFramebuffers(1, &fbo));
-    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
-    GLDEBUG(glBindTexture(GL_TEXTURE_2D, tex[1]));
-    GLDEBUG(glTexImage2D(GL_TEXTURE_2D, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE,
-                         NULL));
-    GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    GLDEBUG(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                   GL_TEXTURE_2D, tex[1], 0));
-
-    GLDEBUG(glReadBuffer(GL_COLOR_ATTACHMENT0));
-    GLDEBUG(glDrawBuffer(GL_COLOR_ATTACHMENT0));
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        FATAL_ERROR("framebuffer is not complete\n");
-        return -1;
+
+    // IVAC_HUD draws graphs of the frame timers over the window
+    const bool show_hud = getenv("IVAC_HUD") != NULL;
+    const bool print_stats = getenv("IVAC_FRAME_STATS") != NULL;
+    FrameTimers frame_timers;
+    FrameTimers* const timers =
+        show_hud || print_stats ? &frame_timers : NULL;
+    if (timers) {
+        frame_timers_init(timers);
+    }
+    Hud hud;
+    if (show_hud) {
+        hud_init(&hud);
     }
 
     GLDEBUG(glClearColor(0, 0, 0, 0));
 
-    while (!glfwWindowShouldClose(win)) {
-        glfwWaitEvents();
+    while (have_saver && !glfwWindowShouldClose(win)) {
+        // Keep the loop going while an upload or a read back is in progress
+        TRACE_BEGIN("events");
+        if (uploading || reading_back) {
+            const double start = get_time_ms();
+            glfwPollEvents();
+            if (timers) {
+                timer_history_add(&timers->events, get_time_ms() - start);
+            }
+        } else {
+            glfwWaitEvents();
+        }
+        TRACE_END();
+        const double frame_start = get_time_ms();
+        const enum loader_stage stage = image_loader_stage(&loader);
+        if (!loaded && !uploading && stage == LOADER_PREVIEW_READY) {
+            // Show the reduced size decode while the rest is decoded
+            if (!texture_upload_start(
+                    &upload, &upload_tiles,
+                    bpp_to_gl_image_format(loader.preview.c),
+                    &loader.preview)) {
+                ret = -1;
+                break;
+            }
+            uploading = &loader.preview;
+        }
+        if (!full_res && uploading != &loader.image && stage == LOADER_DONE) {
+            // A preview that is still uploading is dropped in favor of the
+            // full image. The loader is only joined on exit, as a preview
+            // slower than the full image may still be decoding.
+            stbi_image_free(loader.preview.data);
+            loader.preview.data = NULL;
+            if (loader.image.data == NULL) {
+                FATAL_ERROR("failed to load %s: %s\n", path, loader.error);
+                ret = -1;
+                break;
+            }
+            if (!texture_upload_start(&upload, &upload_tiles,
+                                      bpp_to_gl_image_format(loader.image.c),
+                                      &loader.image)) {
+                ret = -1;
+                break;
+            }
+            uploading = &loader.image;
+        }
+        bool uploaded = false;
+        if (uploading) {
+            const double start = get_time_ms();
+            uploaded = texture_upload_step(&upload);
+            if (timers) {
+                timer_history_add(&timers->upload, get_time_ms() - start);
+            }
+        }
+        if (uploaded) {
+            const TileGrid prev_tiles = tiles[0];
+            tiles[0] = upload_tiles;
+            upload_tiles = prev_tiles;
+            if (!setup_target_tiles(&tiles[1], &tiles[0], fbo)) {
+                ret = -1;
+                break;
+            }
+            // The source is displayed directly while the slider is dragged
+            tile_grid_generate_mipmaps(&tiles[0]);
+            processed_contrast = -1;
+            full_res = uploading == &loader.image;
+            stbi_image_free(uploading->data);
+            uploading->data = NULL;
+            uploading = NULL;
+            loaded = true;
+            dirty = true;
+        }
         if (dirty) {
             dirty = false;
-
-            // First render image to framebuffer, adjusting the contrast
-            GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
-            GLDEBUG(glViewport(0, 0, w, h));
-            GLDEBUG(glClear(GL_COLOR_BUFFER_BIT));
-
-            GLDEBUG(glUseProgram(image_shader));
-            GLDEBUG(glBindTexture(GL_TEXTURE_2D, tex[0]));
-            // Note: Here I'm manually setting the uniform position. Be
-            // sure to update when editing shaders!
-            GLDEBUG(glUniform1f(1, 1 - logf(contrast * 2)));
-            GLDEBUG(glBindVertexArray(image.vao));
-            build_first_image_buffer(image.vbo);
-            GLDEBUG(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+            ++num_frames;
+
+            // While the slider is dragged display_shader adjusts the
+            // contrast of the source on the fly, which only costs as much as
+            // the pixels on screen. The whole image is processed into
+            // tiles[1] once the handle is released.
+            const bool interactive = dragging_handle;
+            if (loaded && !interactive && contrast != processed_contrast) {
+                apply_slider_contrast(&tiles[0], &tiles[1], fbo, image_shader,
+                                      &quad, timers);
+                processed_contrast = contrast;
+                ++num_contrast_passes;
+            }
 
             // Now render to screen
+            TRACE_BEGIN("display pass");
+            if (timers) {
+                gpu_timer_begin(&timers->display);
+            }
             GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, 0));
             GLDEBUG(glViewport(0, 0, viewport[0], viewport[1]));
             GLDEBUG(glClear(GL_COLOR_BUFFER_BIT));
 
-            // Render the edited image
-            GLDEBUG(glUseProgram(display_shader));
-            GLDEBUG(glBindTexture(GL_TEXTURE_2D, tex[1]));
-            // The image vao is already bound
-            build_image_buffer(w, h, image.vbo);
-            GLDEBUG(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+            GLDEBUG(glBindVertexArray(quad.vao));
+            if (loaded) {
+                // Render the edited image, skipping tiles that are off screen
+                const TileGrid* const shown =
+                    interactive ? &tiles[0] : &tiles[1];
+                GLDEBUG(glUseProgram(display_shader));
+                // Note: Here I'm manually setting the uniform position. Be
+                // sure to update when editing shaders!
+                GLDEBUG(glUniform1f(
+                    1, interactive ? 1 - logf(contrast * 2) : 1));
+                for (int i = 0; i < tile_grid_count(shown); ++i) {
+                    float bounds[4], uv_bounds[4];
+                    if (!get_tile_bounds(w, h, shown, i, bounds, uv_bounds)) {
+                        continue;
+                    }
+                    GLDEBUG(glUniform4fv(2, 1, bounds));
+                    GLDEBUG(glUniform4fv(3, 1, uv_bounds));
+                    GLDEBUG(glBindTexture(GL_TEXTURE_2D, shown->tex[i]));
+                    GLDEBUG(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+                }
+            }
 
-            // Render the slider
+            // Render the slider, and the placeholder if there's no image yet,
+            // all in one draw call
             GLDEBUG(glUseProgram(gui_shader));
             GLDEBUG(glBindVertexArray(gui.vao));
-            for (int i = 0; i < NUM_WIDGETS; ++i) {
-                // Note: Here I'm manually setting the uniform position. Be
-                // sure to update when editing shader uniforms!
-                GLDEBUG(glUniform3fv(0, 1, widgets[i].color));
-                build_quad_buffer(gui.vbo, widgets[i].get_bounds());
-                GLDEBUG(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+            const double gui_start = get_time_ms();
+            const int num_gui_instances =
+                build_gui_buffer(w, h, !loaded, gui.vbo);
+            if (timers) {
+                timer_history_add(&timers->gui, get_time_ms() - gui_start);
+            }
+            GLDEBUG(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4,
+                                          num_gui_instances));
+
+            if (timers) {
+                gpu_timer_end(&timers->display);
+                timer_history_add(&timers->frame,
+                                  get_time_ms() - frame_start);
             }
+            TRACE_END();
+            if (show_hud) {
+                TRACE_BEGIN("hud");
+                // The HUD isn't part of the timed display pass
+                const HudGraph graphs[] = {
+                    {&timers->display.history, {0.4, 1.0, 0.4}},
+                    {&timers->contrast.history, {0.4, 0.6, 1.0}},
+                    {&timers->frame, {1.0, 1.0, 1.0}},
+                    {&timers->events, {1.0, 0.9, 0.3}},
+                    {&timers->upload, {1.0, 0.6, 0.2}},
+                    {&timers->gui, {1.0, 0.4, 0.8}},
+                };
+                hud_draw(&hud, gui_shader, graphs,
+                         sizeof(graphs) / sizeof(*graphs), viewport[0],
+                         viewport[1]);
+                TRACE_END();
+            }
+            TRACE_BEGIN("swap buffers");
             glfwSwapBuffers(win);
+            TRACE_END();
         }
-        if (save_image) {
+        // Saving waits until the full resolution image is in
+        if (save_image && full_res) {
             save_image = false;
-            const size_t bufsize = w * h * c;
-            uint8_t* data = malloc(bufsize);
-            if (!data) {
-                FATAL_ERROR("failed to allocate %zu bytes\n", bufsize);
-                continue;
+            if (contrast != processed_contrast) {
+                apply_slider_contrast(&tiles[0], &tiles[1], fbo, image_shader,
+                                      &quad, timers);
+                processed_contrast = contrast;
+                ++num_contrast_passes;
+            }
+            // Nothing has been queued if it fails, so saving again can simply
+            // start over
+            if (image_saver_start(&saver, save_path, &tiles[1], c, fbo)) {
+                printf("Saving image to %s\n", save_path);
+            } else {
+                FATAL_ERROR("image not saved, press save to try again\n");
             }
-            GLDEBUG(
-                glGetTexImage(GL_TEXTURE_2D, 0, fmt, GL_UNSIGNED_BYTE, data));
-            printf("Saving image to out.jpg\n");
-            stbi_write_jpg("out.jpg", w, h, c, data, 100);
-            free(data);
+        }
+        reading_back = image_saver_poll(&saver);
+        if (timers) {
+            gpu_timer_poll(&timers->contrast);
+            gpu_timer_poll(&timers->display);
         }
     }
 
+    if (print_stats) {
+        printf("Drew %lu frames, %lu with the contrast pass\n", num_frames,
+               num_contrast_passes);
+        // Averages over the last TIMER_HISTORY samples of each
+        printf("Average ms: frame %.2f, events %.3f, GUI %.3f, upload step "
+               "%.2f, contrast pass %.2f (GPU), display %.2f (GPU)\n",
+               timer_history_average(&timers->frame),
+               timer_history_average(&timers->events),
+               timer_history_average(&timers->gui),
+               timer_history_average(&timers->upload),
+               timer_history_average(&timers->contrast.history),
+               timer_history_average(&timers->display.history));
+    }
+    if (timers) {
+        frame_timers_deinit(timers);
+    }
+    if (show_hud) {
+        hud_deinit(&hud);
+    }
+
+    // Don't leave the decode thread running if we exit early
+    image_loader_join(&loader);
+    stbi_image_free(loader.preview.data);
+    stbi_image_free(loader.image.data);
+    // Finishes any saves still in flight
+    if (have_saver) {
+        image_saver_deinit(&saver);
+    }
     GLDEBUG(glDeleteFramebuffers(1, &fbo));
-    GLDEBUG(glDeleteTextures(2, tex));
+    tile_grid_deinit(&tiles[0]);
+    tile_grid_deinit(&tiles[1]);
+    tile_grid_deinit(&upload_tiles);
+    texture_upload_deinit(&upload);
     GLDEBUG(glDeleteProgram(gui_shader));
     GLDEBUG(glDeleteProgram(image_shader));
     GLDEBUG(glDeleteProgram(display_shader));
-    vertex_object_deinit(&image);
+    vertex_object_deinit(&quad);
     vertex_object_deinit(&gui);
+    glfwDestroyWindow(win);
+    glfwTerminate();
+    if (have_pool) {
+        stop_pool(&pool);
+    }
+    return ret;
+}
 
-    return 0;
+int main(const int argc, const char* const* const argv) {
+    // IVAC_TRACE records where the time goes into a trace file
+    const char* const trace_path = getenv("IVAC_TRACE");
+    if (trace_path != NULL && trace_init(trace_path)) {
+        trace_thread_name("main");
+    }
+
+    int ret;
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        ret = batch_main(argc - 2, argv + 2);
+    } else if (argc != 2) {
+        FATAL_ERROR("expected 1 argument, got %d\n", argc - 1);
+        ret = -1;
+    } else {
+        ret = run_viewer(argv[1]);
+    }
+    // Every other thread has stopped by now, however the viewer or the batch
+    // returned
+    trace_shutdown();
+    return ret;
 }
+
@@ -0,0 +1,148 @@
+#include "pool.h"
+
+#include "shader.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+struct pool_job {
+    void (*task)(void*, int);
+    void* data;
+    int count;
+    // Next index to hand out
+    int next;
+    // Tasks that haven't finished yet
+    int remaining;
+    struct pool_job* next_job;
+};
+
+int get_num_cpus() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+static void remove_job(ThreadPool* pool, struct pool_job* job) {
+    struct pool_job** j = &pool->jobs;
+    while (*j != job) {
+        j = &(*j)->next_job;
+    }
+    *j = job->next_job;
+}
+
+// Takes the next task of job and runs it with the mutex unlocked. The mutex
+// must be held when calling.
+static void run_task(ThreadPool* pool, struct pool_job* job) {
+    const int i = job->next++;
+    if (job->next == job->count) {
+        remove_job(pool, job);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    job->task(job->data, i);
+    pthread_mutex_lock(&pool->mutex);
+    if (--job->remaining == 0) {
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    ThreadPool* pool = arg;
+    trace_thread_name("worker");
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->quit && pool->jobs == NULL) {
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        }
+        if (pool->quit) {
+            break;
+        }
+        run_task(pool, pool->jobs);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+bool thread_pool_init(ThreadPool* pool, int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = get_num_cpus() - 1;
+    }
+    pool->jobs = NULL;
+    pool->quit = false;
+    pool->num_threads = 0;
+    pool->threads = malloc(sizeof(pthread_t) * (num_threads + 1));
+    if (pool->threads == NULL) {
+        FATAL_ERROR("malloc failed\n");
+        return false;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (int i = 0; i < num_threads; ++i) {
+        int err = pthread_create(&pool->threads[i], NULL, worker_thread, pool);
+        if (err != 0) {
+            // Carry on with what we have, callers run tasks themselves anyway
+            FATAL_ERROR("failed to start worker thread: %d\n", err);
+            break;
+        }
+        pool->num_threads++;
+    }
+    return true;
+}
+
+void thread_pool_deinit(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+void thread_pool_parallel_for(ThreadPool* pool, void (*task)(void*, int),
+                              void* data, int count) {
+    if (count <= 0) {
+        return;
+    }
+    struct pool_job job = {
+        .task = task,
+        .data = data,
+        .count = count,
+        .next = 0,
+        .remaining = count,
+        .next_job = NULL,
+    };
+
+    pthread_mutex_lock(&pool->mutex);
+    // Append so earlier jobs finish first
+    struct pool_job** j = &pool->jobs;
+    while (*j != NULL) {
+        j = &(*j)->next_job;
+    }
+    *j = &job;
+    if (count > 1) {
+        pthread_cond_broadcast(&pool->work_cond);
+    }
+    while (job.next < job.count) {
+        run_task(pool, &job);
+    }
+    while (job.remaining > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
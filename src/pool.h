@@ -0,0 +1,38 @@
+#ifndef IVAC_SRC_POOL_H_M2CE5TQA
+#define IVAC_SRC_POOL_H_M2CE5TQA
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct pool_job;
+
+// A fixed set of worker threads for splitting work into independent tasks.
+// Any number of threads may submit work at the same time.
+typedef struct thread_pool {
+    pthread_t* threads;
+    int num_threads;
+
+    pthread_mutex_t mutex;
+    // Signaled when a job is submitted or the pool shuts down
+    pthread_cond_t work_cond;
+    // Signaled when a job's last task finishes
+    pthread_cond_t done_cond;
+    // Jobs that still have tasks to hand out
+    struct pool_job* jobs;
+    bool quit;
+} ThreadPool;
+
+// Starts num_threads workers, or one per CPU besides the calling thread if
+// num_threads is 0
+bool thread_pool_init(ThreadPool* pool, int num_threads);
+void thread_pool_deinit(ThreadPool* pool);
+
+// Calls task(data, i) for every i in [0, count) and waits for them all to
+// finish. The calling thread runs tasks too.
+void thread_pool_parallel_for(ThreadPool* pool, void (*task)(void*, int),
+                              void* data, int count);
+
+// Number of CPUs available to the process
+int get_num_cpus(void);
+
+#endif /* IVAC_SRC_POOL_H_M2CE5TQA */
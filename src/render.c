@@ -0,0 +1,92 @@
+#include "render.h"
+
+#include "shader.h"
+#include "trace.h"
+
+#include <assert.h>
+
+GLint bpp_to_gl_image_format(unsigned int bpp) {
+    switch (bpp) {
+    case 4: return GL_RGBA;
+    case 3: return GL_RGB;
+    case 2: return GL_RG;
+    case 1: return GL_RED;
+    default: return GL_RGBA;
+    }
+}
+
+void build_quad_buffer(GLuint vbo) {
+    const float verts[4][2] = {
+        {0, 1},
+        {0, 0},
+        {1, 1},
+        {1, 0},
+    };
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    GLDEBUG(glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts,
+                         GL_STATIC_DRAW));
+    GLDEBUG(glBindBuffer(GL_ARRAY_BUFFER, 0));
+}
+
+bool setup_target_tiles(TileGrid* tiles, const TileGrid* source, GLuint fbo) {
+    if (!tile_grid_alloc(tiles, source->w, source->h, source->fmt)) {
+        return false;
+    }
+
+    // Set up the framebuffer object
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+    GLDEBUG(glReadBuffer(GL_COLOR_ATTACHMENT0));
+    GLDEBUG(glDrawBuffer(GL_COLOR_ATTACHMENT0));
+    for (int i = 0; i < tile_grid_count(tiles); ++i) {
+        GLDEBUG(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, tiles->tex[i], 0));
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+            GL_FRAMEBUFFER_COMPLETE) {
+            FATAL_ERROR("framebuffer is not complete\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+void apply_contrast(const TileGrid* source, const TileGrid* target, GLuint fbo,
+                    GLuint image_shader, GLuint quad_vao, float factor) {
+    TRACE_BEGIN("contrast pass");
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+    GLDEBUG(glUseProgram(image_shader));
+    // Note: Here I'm manually setting the uniform position. Be sure to update
+    // when editing shaders!
+    GLDEBUG(glUniform1f(1, factor));
+    GLDEBUG(glUniform1i(2, source->fmt == GL_RG));
+    GLDEBUG(glBindVertexArray(quad_vao));
+    for (int i = 0; i < tile_grid_count(target); ++i) {
+        TileRect content, stored;
+        tile_grid_get_rects(target, i, &content, &stored);
+        GLDEBUG(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, target->tex[i], 0));
+        GLDEBUG(glViewport(0, 0, stored.w, stored.h));
+        GLDEBUG(glBindTexture(GL_TEXTURE_2D, source->tex[i]));
+        GLDEBUG(glDrawArrays(GL_TRIANGLE_STRIP, 0, 4));
+    }
+    TRACE_END();
+}
+
+// Like the image saver, but straight into client memory
+void read_tiles(const TileGrid* tiles, int c, GLuint fbo, uint8_t* pixels) {
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+    GLDEBUG(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    GLDEBUG(glPixelStorei(GL_PACK_ROW_LENGTH, tiles->w));
+    for (int i = 0; i < tile_grid_count(tiles); ++i) {
+        TileRect content, stored;
+        tile_grid_get_rects(tiles, i, &content, &stored);
+        const size_t offset = ((size_t)content.y * tiles->w + content.x) * c;
+        GLDEBUG(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, tiles->tex[i], 0));
+        GLDEBUG(glReadPixels(content.x - stored.x, content.y - stored.y,
+                             content.w, content.h, tiles->fmt,
+                             GL_UNSIGNED_BYTE, pixels + offset));
+    }
+    GLDEBUG(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+    GLDEBUG(glPixelStorei(GL_PACK_ROW_LENGTH, 0));
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+}
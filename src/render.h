@@ -0,0 +1,32 @@
+#ifndef IVAC_SRC_RENDER_H_T3MVQ8KA
+#define IVAC_SRC_RENDER_H_T3MVQ8KA
+
+#include "gl_core_4_3.h"
+#include "tiles.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The GL side of processing an image, shared by the viewer and headless
+// processing so both go through the exact same passes.
+
+GLint bpp_to_gl_image_format(unsigned int bpp);
+
+// Uploads the one quad every shader draws, going from (0, 0) to (1, 1). Each
+// draw call places it with uniforms, so it never has to be rebuilt.
+void build_quad_buffer(GLuint vbo);
+
+// Allocates the tiles rendered into through fbo, matching the ones that were
+// just uploaded
+bool setup_target_tiles(TileGrid* tiles, const TileGrid* source, GLuint fbo);
+
+// Renders source into target tile by tile with the image shader, mixing with
+// mid grey by factor. quad_vao draws the quad from build_quad_buffer.
+void apply_contrast(const TileGrid* source, const TileGrid* target, GLuint fbo,
+                    GLuint image_shader, GLuint quad_vao, float factor);
+
+// Reads back each tile's own part of the image into pixels, which holds the
+// whole image with c channels. Waits for the GPU, unlike the image saver.
+void read_tiles(const TileGrid* tiles, int c, GLuint fbo, uint8_t* pixels);
+
+#endif /* IVAC_SRC_RENDER_H_T3MVQ8KA */
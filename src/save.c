@@ -0,0 +1,226 @@
+#include "save.h"
+
+#include "shader.h"
+#include "trace.h"
+#include "stb_image_write.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// How long to wait for the oldest read back before giving up for this frame,
+// in nanoseconds
+#define SAVE_WAIT_NS 1000000
+
+struct save_job {
+    const char* path;
+    int w, h, c;
+    GLuint pbo;
+    // Signaled once the pixels have been written into pbo
+    GLsync fence;
+    // The mapped contents of pbo, once the fence has been signaled
+    const uint8_t* data;
+    struct save_job* next;
+};
+
+static void append_job(struct save_job** list, struct save_job* job) {
+    while (*list) {
+        list = &(*list)->next;
+    }
+    job->next = NULL;
+    *list = job;
+}
+
+bool write_image_file(const char* path, int w, int h, int c,
+                      const uint8_t* data) {
+    TRACE_BEGIN("encode");
+    const size_t len = strlen(path);
+    bool ok;
+    if (len >= 4 && strcmp(path + len - 4, ".png") == 0) {
+        ok = stbi_write_png(path, w, h, c, data, 0);
+    } else {
+        ok = stbi_write_jpg(path, w, h, c, data, 100);
+    }
+    TRACE_END();
+    return ok;
+}
+
+static void* writer_thread(void* arg) {
+    ImageSaver* saver = arg;
+    trace_thread_name("writer");
+    pthread_mutex_lock(&saver->mutex);
+    while (true) {
+        while (!saver->quit && saver->queue == NULL) {
+            pthread_cond_wait(&saver->cond, &saver->mutex);
+        }
+        // Everything queued is still written before exiting
+        if (saver->queue == NULL) {
+            break;
+        }
+        struct save_job* const job = saver->queue;
+        saver->queue = job->next;
+        pthread_mutex_unlock(&saver->mutex);
+
+        const bool ok =
+            write_image_file(job->path, job->w, job->h, job->c, job->data);
+        if (!ok) {
+            FATAL_ERROR("failed to write %s\n", job->path);
+        }
+
+        pthread_mutex_lock(&saver->mutex);
+        saver->num_failed += !ok;
+        append_job(&saver->done, job);
+        if (saver->notify) {
+            saver->notify();
+        }
+    }
+    pthread_mutex_unlock(&saver->mutex);
+    return NULL;
+}
+
+bool image_saver_init(ImageSaver* saver, void (*notify)(void)) {
+    saver->notify = notify;
+    saver->reading = NULL;
+    saver->queue = NULL;
+    saver->done = NULL;
+    saver->num_failed = 0;
+    saver->quit = false;
+    pthread_mutex_init(&saver->mutex, NULL);
+    pthread_cond_init(&saver->cond, NULL);
+
+    int err = pthread_create(&saver->thread, NULL, writer_thread, saver);
+    if (err != 0) {
+        FATAL_ERROR("failed to start writer thread: %d\n", err);
+        pthread_cond_destroy(&saver->cond);
+        pthread_mutex_destroy(&saver->mutex);
+        return false;
+    }
+    return true;
+}
+
+void image_saver_deinit(ImageSaver* saver) {
+    while (image_saver_poll(saver)) {
+    }
+    pthread_mutex_lock(&saver->mutex);
+    saver->quit = true;
+    pthread_cond_signal(&saver->cond);
+    pthread_mutex_unlock(&saver->mutex);
+    pthread_join(saver->thread, NULL);
+
+    // Release whatever the writer finished while exiting
+    image_saver_poll(saver);
+    assert(saver->queue == NULL && saver->done == NULL);
+    pthread_cond_destroy(&saver->cond);
+    pthread_mutex_destroy(&saver->mutex);
+}
+
+bool image_saver_start(ImageSaver* saver, const char* path,
+                       const TileGrid* tiles, int c, GLuint fbo) {
+    struct save_job* const job = malloc(sizeof(*job));
+    if (job == NULL) {
+        FATAL_ERROR("failed to allocate save of %s\n", path);
+        return false;
+    }
+    job->path = path;
+    job->w = tiles->w;
+    job->h = tiles->h;
+    job->c = c;
+    job->data = NULL;
+
+    TRACE_BEGIN("readback");
+    GLDEBUG(glGenBuffers(1, &job->pbo));
+    GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo));
+    gl_debug_label(GL_BUFFER, job->pbo, "readback buffer");
+    GLDEBUG(glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)job->w * job->h * c,
+                         NULL, GL_STREAM_READ));
+
+    // Read each tile's own part into its place in the image. These only queue
+    // copies into the buffer, nothing waits for the GPU here.
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+    GLDEBUG(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+    GLDEBUG(glPixelStorei(GL_PACK_ROW_LENGTH, job->w));
+    for (int i = 0; i < tile_grid_count(tiles); ++i) {
+        TileRect content, stored;
+        tile_grid_get_rects(tiles, i, &content, &stored);
+        const size_t offset = ((size_t)content.y * job->w + content.x) * c;
+        GLDEBUG(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       GL_TEXTURE_2D, tiles->tex[i], 0));
+        GLDEBUG(glReadPixels(content.x - stored.x, content.y - stored.y,
+                             content.w, content.h, tiles->fmt,
+                             GL_UNSIGNED_BYTE, (void*)(uintptr_t)offset));
+    }
+    GLDEBUG(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+    GLDEBUG(glPixelStorei(GL_PACK_ROW_LENGTH, 0));
+    GLDEBUG(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+    job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    TRACE_END();
+    append_job(&saver->reading, job);
+    return true;
+}
+
+static void release_job(struct save_job* job) {
+    GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo));
+    if (job->data) {
+        GLDEBUG(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+    }
+    GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+    GLDEBUG(glDeleteBuffers(1, &job->pbo));
+    free(job);
+}
+
+bool image_saver_poll(ImageSaver* saver) {
+    // Read backs finish in the order they were started, so only the oldest
+    // one is waited on
+    GLuint64 timeout = SAVE_WAIT_NS;
+    while (saver->reading) {
+        struct save_job* const job = saver->reading;
+        const GLenum status =
+            glClientWaitSync(job->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        if (status == GL_WAIT_FAILED) {
+            FATAL_ERROR("glClientWaitSync failed\n");
+        }
+        timeout = 0;
+        GLDEBUG(glDeleteSync(job->fence));
+        saver->reading = job->next;
+
+        // The buffer stays mapped while the writer encodes straight out of it
+        TRACE_BEGIN("map readback");
+        GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo));
+        job->data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                     (size_t)job->w * job->h * job->c,
+                                     GL_MAP_READ_BIT);
+        GLDEBUG(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+        TRACE_END();
+        if (job->data == NULL) {
+            FATAL_ERROR("failed to map pixels of %s\n", job->path);
+            release_job(job);
+            pthread_mutex_lock(&saver->mutex);
+            ++saver->num_failed;
+            if (saver->notify) {
+                saver->notify();
+            }
+            pthread_mutex_unlock(&saver->mutex);
+            continue;
+        }
+        pthread_mutex_lock(&saver->mutex);
+        append_job(&saver->queue, job);
+        pthread_cond_signal(&saver->cond);
+        pthread_mutex_unlock(&saver->mutex);
+    }
+
+    pthread_mutex_lock(&saver->mutex);
+    struct save_job* done = saver->done;
+    saver->done = NULL;
+    pthread_mutex_unlock(&saver->mutex);
+    while (done) {
+        struct save_job* const next = done->next;
+        release_job(done);
+        done = next;
+    }
+    return saver->reading != NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef IVAC_SRC_SAVE_H_W4FQ8NRB
+#define IVAC_SRC_SAVE_H_W4FQ8NRB
+
+#include "gl_core_4_3.h"
+#include "tiles.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct save_job;
+
+// Saves images without blocking the render thread. The pixels are read back
+// into a pixel buffer object and only mapped once a fence says the GPU has
+// written them, then a background thread encodes the image straight out of the
+// mapped buffer. Any number of saves can be in flight, they're written in the
+// order they were started.
+typedef struct image_saver {
+    pthread_t thread;
+    // Called whenever a save has finished, written or not, usually from the
+    // writer thread
+    void (*notify)(void);
+
+    // Saves still being read back, oldest first. Only used by the GL thread.
+    struct save_job* reading;
+
+    pthread_mutex_t mutex;
+    // Signaled when a save is queued or the writer should exit
+    pthread_cond_t cond;
+    // Saves waiting for the writer thread, oldest first
+    struct save_job* queue;
+    // Saves the writer has finished, waiting for their buffers to be released
+    struct save_job* done;
+    // Saves that couldn't be written, guarded by mutex
+    int num_failed;
+    bool quit;
+} ImageSaver;
+
+// Starts the writer thread. notify may be NULL.
+bool image_saver_init(ImageSaver* saver, void (*notify)(void));
+// Finishes every save that has been started, then stops the writer thread
+void image_saver_deinit(ImageSaver* saver);
+
+// Starts reading back tiles through fbo, to be written to path with c
+// channels, as a PNG if path ends in .png and a JPEG otherwise. path has to
+// stay valid until the save has been written.
+bool image_saver_start(ImageSaver* saver, const char* path,
+                       const TileGrid* tiles, int c, GLuint fbo);
+// Hands saves whose pixels have arrived to the writer thread and releases the
+// ones it has finished. Returns true while a read back is still in flight, in
+// which case this should be called again soon.
+bool image_saver_poll(ImageSaver* saver);
+
+// Writes w x h pixels with c channels to path straight away, as a PNG if path
+// ends in .png and a JPEG otherwise
+bool write_image_file(const char* path, int w, int h, int c,
+                      const uint8_t* data);
+
+#endif /* IVAC_SRC_SAVE_H_W4FQ8NRB */
@@ -23,7 +23,7 @@ static GLuint compile_shader(GLenum type, const char* const source) {
 }
 
 GLuint shader_new(const char* const vertex_source,
-                  const char* const fragment_source) {
+                  const char* const fragment_source, const char* label) {
     GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
     GLuint fragment_shader =
         compile_shader(GL_FRAGMENT_SHADER, fragment_source);
@@ -49,76 +49,99 @@ GLuint shader_new(const char* const vertex_source,
     }
     glDeleteShader(vertex_shader);
     glDeleteShader(fragment_shader);
+    gl_debug_label(GL_PROGRAM, program, label);
     return program;
 }
 
 GLuint get_gui_shader() {
+    // Draws one quad per instance, so every widget can be drawn in one call.
+    // bounds holds the screen positions of the quad's (0, 0) and (1, 1)
+    // corners, which are picked by the vertex index.
     const char* const vertex_source =
         "#version 430 core\n"
-        "in vec2 pos;\n"
+        "layout(location = 0) in vec4 bounds;\n"
+        "layout(location = 1) in vec3 v_color;\n"
+        "flat out vec3 color;\n"
         "void main() {\n"
-        "    gl_Position = vec4(pos, 0.0, 1.0);\n"
+        "    vec2 pos = vec2(gl_VertexID >> 1, 1 - (gl_VertexID & 1));\n"
+        "    color = v_color;\n"
+        "    gl_Position = vec4(mix(bounds.xy, bounds.zw, pos), 0.0, 1.0);\n"
         "}\n";
 
-    // Be sure to update uniform setting when changing uniform positions
     const char* const fragment_source =
         "#version 430 core\n"
+        "flat in vec3 color;\n"
         "out vec4 frag_color;\n"
-        "uniform vec3 color;\n"
         "void main() {\n"
         "    frag_color = vec4(color, 1.0);\n"
         "}\n";
 
-    return shader_new(vertex_source, fragment_source);
+    return shader_new(vertex_source, fragment_source, "gui shader");
 }
 
 GLuint get_image_shader() {
+    // Always covers the whole framebuffer
     const char* const vertex_source =
         "#version 430 core\n"
         "in vec2 pos;\n"
-        "in vec2 v_uv;\n"
         "out vec2 uv;\n"
         "void main() {\n"
-        "    uv = v_uv;\n"
-        "    gl_Position = vec4(pos, 0.0, 1.0);\n"
+        "    uv = pos;\n"
+        "    gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);\n"
         "}\n";
 
+    // Grey and alpha tiles are sampled as grey, but only have room for the
+    // red and green channels when rendered into, so grey_alpha packs them
+    // back the way they're stored.
     // Be sure to update uniform setting when changing uniform positions
     const char* const fragment_source =
         "#version 430 core\n"
         "in vec2 uv;\n"
         "out vec4 frag_color;\n"
-        "uniform sampler2D tex;\n"
-        "uniform float contrast;\n"
+        "layout(location = 0) uniform sampler2D tex;\n"
+        "layout(location = 1) uniform float contrast;\n"
+        "layout(location = 2) uniform bool grey_alpha;\n"
         "vec4 average_luminance = vec4(0.5, 0.5, 0.5, 1.0);\n"
         "void main() {\n"
         "    vec4 tex_color = texture(tex, uv);\n"
         "    frag_color = mix(average_luminance, tex_color, contrast);\n"
+        "    if (grey_alpha) {\n"
+        "        frag_color = vec4(frag_color.ra, 0.0, 1.0);\n"
+        "    }\n"
         "}\n";
 
-    return shader_new(vertex_source, fragment_source);
+    return shader_new(vertex_source, fragment_source, "image shader");
 }
 
 GLuint get_display_shader() {
+    // pos goes from (0, 0) to (1, 1) across the quad, bounds and uv_bounds
+    // hold the screen positions and texture coordinates of those two corners
     const char* const vertex_source =
         "#version 430 core\n"
         "in vec2 pos;\n"
-        "in vec2 v_uv;\n"
         "out vec2 uv;\n"
+        "layout(location = 2) uniform vec4 bounds;\n"
+        "layout(location = 3) uniform vec4 uv_bounds;\n"
         "void main() {\n"
-        "    uv = v_uv;\n"
-        "    gl_Position = vec4(pos, 0.0, 1.0);\n"
+        "    uv = mix(uv_bounds.xy, uv_bounds.zw, pos);\n"
+        "    gl_Position = vec4(mix(bounds.xy, bounds.zw, pos), 0.0, 1.0);\n"
         "}\n";
 
+    // Applies the same adjustment as the image shader so it can be previewed
+    // without processing the whole image. contrast is 1 when drawing an image
+    // that has already been processed.
     // Be sure to update uniform setting when changing uniform positions
     const char* const fragment_source =
         "#version 430 core\n"
         "in vec2 uv;\n"
         "out vec4 frag_color;\n"
-        "uniform sampler2D tex;\n"
+        "layout(location = 0) uniform sampler2D tex;\n"
+        "layout(location = 1) uniform float contrast;\n"
+        "vec4 average_luminance = vec4(0.5, 0.5, 0.5, 1.0);\n"
         "void main() {\n"
-        "    frag_color = texture(tex, uv);\n"
+        "    vec4 tex_color = texture(tex, uv);\n"
+        "    frag_color = mix(average_luminance, tex_color, contrast);\n"
         "}\n";
 
-    return shader_new(vertex_source, fragment_source);
+    return shader_new(vertex_source, fragment_source, "display shader");
 }
@@ -2,28 +2,16 @@
 #define IVAC_SRC_SHADER_H_NGAJOF2E
 
 #include "gl_core_4_3.h"
+#include "gl_debug.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
 #define FATAL_ERROR(...) fprintf(stderr, "Error: " __VA_ARGS__)
 
-#if 1
-#define GLDEBUG(x)                                                             \
-    x;                                                                         \
-    {                                                                          \
-        GLenum e;                                                              \
-        if ((e = glGetError()) != GL_NO_ERROR) {                               \
-            printf("glError 0x%x at %s line %d\n", e, __FILE__, __LINE__);     \
-            assert(false);                                                     \
-        }                                                                      \
-    }
-#else
-#define GLDEBUG(x) (x)
-#endif
-
+// label names the program in debug messages
 GLuint shader_new(const char* const vertex_source,
-                  const char* const fragment_source);
+                  const char* const fragment_source, const char* label);
 
 GLuint get_gui_shader(void);
 GLuint get_image_shader(void);
@@ -267,6 +267,12 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// On top of SSE2, the IDCT and YCbCr->RGB conversion also have AVX2 versions
+// that process two blocks or 16 pixels at a time. They are compiled with
+// per-function target attributes and only used if the CPU reports AVX2 at
+// run-time, so the rest of the library still only requires SSE2. Define
+// STBI_NO_AVX2 to leave them out.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -514,12 +520,33 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// decode JPEGs at 1/denom of their size (denom is 1, 2, 4 or 8) by running a
+// reduced IDCT on only the lowest frequency coefficients of each block. the
+// image's reported size is rounded up. other formats are unaffected.
+STBIDEF void stbi_set_jpeg_scale_on_load(int denom);
+
+// run independent pieces of decoding work (JPEG restart intervals and color
+// conversion bands) on the caller's threads. parallel_for must call
+// task(task_data, i) for every i in [0,count) and only return once all of
+// them have finished. by default everything runs on the calling thread.
+// only images decoded from memory are split up this way.
+typedef void stbi_parallel_task(void *task_data, int index);
+typedef void stbi_parallel_for_func(void *user, stbi_parallel_task *task, void *task_data, int count);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *parallel_for, void *user);
+
+// the phases of decoding (JPEG entropy decoding and color conversion, PNG
+// inflate and unfiltering) are bracketed with STBI_TRACE_BEGIN(name) and
+// STBI_TRACE_END(), where name is a string literal. #define both before
+// including the implementation to feed them to a profiler; by default they
+// do nothing. they nest, and always come in pairs on the same thread.
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denom);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -600,6 +627,11 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #define STBI_ASSERT(x) assert(x)
 #endif
 
+#ifndef STBI_TRACE_BEGIN
+#define STBI_TRACE_BEGIN(name) ((void) 0)
+#define STBI_TRACE_END() ((void) 0)
+#endif
+
 #ifdef __cplusplus
 #define STBI_EXTERN extern "C"
 #else
@@ -640,12 +672,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -747,7 +781,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -758,7 +792,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -768,9 +802,44 @@ static int stbi__sse2_available(void)
 }
 #endif
 
+#endif
+
+// AVX2 can't be assumed the way SSE2 is on x64, so those kernels are built
+// with a target attribute (GCC/Clang) and picked at run-time.
+#if !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG)
+#if (defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define STBI_AVX2
 #endif
 #endif
 
+#ifdef STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,1);
+   // AVX and OSXSAVE, and the OS saves the YMM registers on context switch
+   if ((info[2] & (3 << 27)) != (3 << 27) || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+   // also checks that the OS has enabled the YMM state
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif // STBI_AVX2
+
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1114,6 +1183,26 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static stbi_parallel_for_func *stbi__parallel_for_func;
+static void *stbi__parallel_for_user;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *parallel_for, void *user)
+{
+   stbi__parallel_for_func = parallel_for;
+   stbi__parallel_for_user = user;
+}
+
+static void stbi__parallel_for(stbi_parallel_task *task, void *task_data, int count)
+{
+   if (stbi__parallel_for_func && count > 1) {
+      stbi__parallel_for_func(stbi__parallel_for_user, task, task_data, count);
+   } else {
+      int i;
+      for (i=0; i < count; ++i)
+         task(task_data, i);
+   }
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1974,10 +2063,19 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// reduced size decoding: each 8x8 block becomes block_size x block_size pixels
+   int scale_shift, block_size;
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+   void (*idct_block_x2_kernel)(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+
+// block waiting for a second one to go through idct_block_x2_kernel with
+   stbi_uc *idct_pending_out;
+   int idct_pending_stride;
+   short idct_pending[64];
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -2489,6 +2587,63 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced size IDCTs used when decoding at 1/2 or 1/4 scale. only the n*n
+// lowest frequency coefficients are used, and the basis functions are
+// evaluated at the centers of the 8/n pixel wide output samples, so the DC
+// term is scaled exactly like in the full IDCT.
+static const int stbi__idct_k4[4][4] = {
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.461939766f), stbi__f2f( 0.353553391f), stbi__f2f( 0.191341716f) },
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.191341716f), stbi__f2f(-0.353553391f), stbi__f2f(-0.461939766f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.191341716f), stbi__f2f(-0.353553391f), stbi__f2f( 0.461939766f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.461939766f), stbi__f2f( 0.353553391f), stbi__f2f(-0.191341716f) },
+};
+static const int stbi__idct_k2[4][4] = {
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.353553391f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.353553391f) },
+};
+
+static void stbi__idct_scaled(stbi_uc *out, int out_stride, short data[64], int n, const int k[4][4])
+{
+   int i,j,u,val[16];
+
+   // columns; constants are scaled up by 1<<12, keep 1 extra bit
+   for (u=0; u < n; ++u) {
+      for (j=0; j < n; ++j) {
+         int sum = 0;
+         for (i=0; i < n; ++i)
+            sum += k[j][i] * data[i*8+u];
+         val[j*4+u] = (sum + (1 << 10)) >> 11;
+      }
+   }
+
+   // rows; remove the remaining 1<<13, rounding and adding 128
+   for (j=0; j < n; ++j, out += out_stride) {
+      for (i=0; i < n; ++i) {
+         int sum = (1 << 12) + (128 << 13);
+         for (u=0; u < n; ++u)
+            sum += k[i][u] * val[j*4+u];
+         out[i] = stbi__clamp(sum >> 13);
+      }
+   }
+}
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_scaled(out, out_stride, data, 4, stbi__idct_k4);
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_scaled(out, out_stride, data, 2, stbi__idct_k2);
+}
+
+// 1/8 scale is just the DC term
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2668,6 +2823,192 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+#ifdef STBI_AVX2
+
+// AVX2 integer IDCT of two blocks at once, one in each 128-bit lane. The
+// unpack/pack instructions used for the transposes work within lanes, so
+// this is exactly the SSE2 version above run on both blocks side by side.
+static STBI__AVX2_TARGET void stbi__idct_avx2_x2(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64])
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // block 0 in the low lane, block 1 in the high lane
+   #define dct_load(k) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (data0 + (k)*8))), \
+                              _mm_loadu_si128((const __m128i *) (data1 + (k)*8)), 1)
+
+   // store two output rows of each block from a packed register
+   #define dct_store2(p) \
+      { \
+         __m128i lo = _mm256_castsi256_si128(p); \
+         __m128i hi = _mm256_extracti128_si256(p, 1); \
+         _mm_storel_epi64((__m128i *) out0, lo); out0 += out_stride0; \
+         _mm_storel_epi64((__m128i *) out0, _mm_shuffle_epi32(lo, 0x4e)); out0 += out_stride0; \
+         _mm_storel_epi64((__m128i *) out1, hi); out1 += out_stride1; \
+         _mm_storel_epi64((__m128i *) out1, _mm_shuffle_epi32(hi, 0x4e)); out1 += out_stride1; \
+      }
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // transpose pass 2
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      // transpose pass 3
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // store
+      dct_store2(p0);
+      dct_store2(p2);
+      dct_store2(p1);
+      dct_store2(p3);
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+#undef dct_store2
+}
+
+#endif // STBI_AVX2
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2912,9 +3253,167 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// IDCT a block into the output, pairing it up with the next one if there is
+// a two-block kernel. The pixels aren't needed until the whole image has been
+// decoded, so the last unpaired block only has to be flushed at the end.
+static void stbi__jpeg_idct(stbi__jpeg *z, stbi_uc *out, int out_stride, short data[64])
+{
+   if (!z->idct_block_x2_kernel) {
+      z->idct_block_kernel(out, out_stride, data);
+   } else if (z->idct_pending_out) {
+      z->idct_block_x2_kernel(z->idct_pending_out, z->idct_pending_stride, z->idct_pending, out, out_stride, data);
+      z->idct_pending_out = NULL;
+   } else {
+      memcpy(z->idct_pending, data, sizeof(z->idct_pending));
+      z->idct_pending_out = out;
+      z->idct_pending_stride = out_stride;
+   }
+}
+
+static void stbi__jpeg_idct_flush(stbi__jpeg *z)
+{
+   if (z->idct_pending_out) {
+      STBI_SIMD_ALIGN(short, data[64]);
+      memcpy(data, z->idct_pending, sizeof(data));
+      z->idct_block_kernel(z->idct_pending_out, z->idct_pending_stride, data);
+      z->idct_pending_out = NULL;
+   }
+}
+
+// baseline scans with restart intervals can be decoded in parallel, since
+// every interval starts with a fresh bit buffer and dc prediction
+#define STBI__MAX_RESTART_TASKS 256
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **seg;       // start of each interval's entropy coded data, plus the end of the scan
+   int num_segs, segs_per_task, num_units;
+   stbi_uc ok[STBI__MAX_RESTART_TASKS];
+} stbi__jpeg_restart_job;
+
+// decode and IDCT one MCU of a baseline scan; for non-interleaved scans an
+// MCU is a single block
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int u)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int k,x,y;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int i = u % w, j = u / w;
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      int i = u % z->img_mcu_x, j = u / z->img_mcu_x;
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = (i*z->img_comp[n].h + x)*z->block_size;
+            int y2 = (j*z->img_comp[n].v + y)*z->block_size;
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+         }
+      }
+   }
+   return 1;
+}
+
+static void stbi__jpeg_restart_task(void *task_data, int t)
+{
+   stbi__jpeg_restart_job *job = (stbi__jpeg_restart_job *) task_data;
+   int seg = t * job->segs_per_task;
+   int seg_end = seg + job->segs_per_task;
+   // each task gets its own copy of the decoder state, reading from its own
+   // slice of the file
+   stbi__jpeg *j = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   stbi__context s;
+   if (seg_end > job->num_segs) seg_end = job->num_segs;
+   job->ok[t] = 0;
+   if (!j) return;
+   STBI_TRACE_BEGIN("jpeg restart task");
+   *j = *job->z;
+   memset(&s, 0, sizeof(s));
+   j->s = &s;
+   for (; seg < seg_end; ++seg) {
+      int u = seg * j->restart_interval;
+      int u_end = u + j->restart_interval;
+      if (u_end > job->num_units) u_end = job->num_units;
+      s.img_buffer = job->seg[seg];
+      s.img_buffer_end = job->seg[seg+1];
+      stbi__jpeg_reset(j);
+      for (; u < u_end; ++u)
+         if (!stbi__jpeg_decode_mcu(j, u)) { STBI_FREE(j); STBI_TRACE_END(); return; }
+   }
+   stbi__jpeg_idct_flush(j);
+   STBI_FREE(j);
+   job->ok[t] = 1;
+   STBI_TRACE_END();
+}
+
+// returns -1 if the scan can't be split at restart markers, in which case
+// nothing has been consumed and the serial decoder should be used instead
+static int stbi__parse_entropy_coded_data_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_restart_job job;
+   stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end;
+   int n = 0, num_tasks, t;
+
+   if (z->scan_n == 1) {
+      int c = z->order[0];
+      job.num_units = ((z->img_comp[c].x+7) >> 3) * ((z->img_comp[c].y+7) >> 3);
+   } else {
+      job.num_units = z->img_mcu_x * z->img_mcu_y;
+   }
+   job.num_segs = (job.num_units + z->restart_interval-1) / z->restart_interval;
+   if (job.num_segs < 2) return -1;
+   job.seg = (stbi_uc **) stbi__malloc_mad2(job.num_segs + 1, sizeof(stbi_uc *), 0);
+   if (!job.seg) return -1;
+
+   // find the start of every interval. the RSTn markers have to cycle through
+   // 0..7 and there have to be exactly as many as the image needs, anything
+   // else is left to the serial decoder's error recovery
+   job.seg[n++] = p;
+   for (;;) {
+      int m;
+      p = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (!p || p+1 >= end) { STBI_FREE(job.seg); return -1; }
+      m = p[1];
+      if (m == 0x00) { p += 2; continue; } // stuffed zero byte
+      if (m == 0xff) { p += 1; continue; } // fill byte
+      if (!STBI__RESTART(m)) break;        // any other marker ends the scan
+      if (n == job.num_segs || m != 0xd0 + ((n-1) & 7)) { STBI_FREE(job.seg); return -1; }
+      job.seg[n++] = p + 2;
+      p += 2;
+   }
+   if (n != job.num_segs) { STBI_FREE(job.seg); return -1; }
+   job.seg[n] = p;
+
+   job.z = z;
+   job.segs_per_task = (job.num_segs + STBI__MAX_RESTART_TASKS-1) / STBI__MAX_RESTART_TASKS;
+   num_tasks = (job.num_segs + job.segs_per_task-1) / job.segs_per_task;
+   stbi__parallel_for(stbi__jpeg_restart_task, &job, num_tasks);
+   STBI_FREE(job.seg);
+   for (t=0; t < num_tasks; ++t)
+      if (!job.ok[t]) return stbi__err("bad huffman code","Corrupt JPEG");
+
+   // continue after the scan, with the marker that ended it still to be read
+   z->s->img_buffer = p;
+   z->marker = STBI__MARKER_none;
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
+   if (!z->progressive && z->restart_interval && stbi__parallel_for_func && !z->s->read_from_callbacks) {
+      int r = stbi__parse_entropy_coded_data_parallel(z);
+      if (r >= 0) return r;
+   }
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
@@ -2930,7 +3429,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2954,11 +3453,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*z->block_size;
+                        int y2 = (j*z->img_comp[n].v + y)*z->block_size;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                      }
                   }
                }
@@ -3055,10 +3554,11 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
             }
          }
       }
+      stbi__jpeg_idct_flush(z);
    }
 }
 
@@ -3294,8 +3794,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->block_size;
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * z->block_size;
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3305,10 +3805,11 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // coefficients are always kept for every block, even when decoding
+         // to a reduced size
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3366,6 +3867,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
          if (!stbi__parse_entropy_coded_data(j)) return 0;
+         stbi__jpeg_idct_flush(j);
          if (j->marker == STBI__MARKER_none ) {
             // handle 0s at the end of image data from IP Kamera 9060
             while (!stbi__at_eof(j->s)) {
@@ -3763,10 +4265,95 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// 16 pixels per iteration, same arithmetic as the SSE2 version (which matches
+// the scalar one exactly). Unlike SSE2 this also handles step == 3, which is
+// what you get when loading RGB without asking for alpha.
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 3 || step == 4) {
+      __m256i bias = _mm256_set1_epi16(128);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+      // drops the alpha byte of each pixel, leaving 12 bytes per 16-byte lane
+      __m256i rgb_shuf = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                          0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+
+      for (; i+15 < count; i += 16) {
+         // load and widen to short: y*256+128, (cr-128)*256, (cb-128)*256
+         __m256i yb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y+i)));
+         __m256i crb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (pcr+i)));
+         __m256i cbb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (pcb+i)));
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(yb, 8), bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_sub_epi16(crb, bias), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_sub_epi16(cbb, bias), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose; pixels 0-7 in the low lane,
+         // 8-15 in the high lane
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels. o0 has pixels 0-3 and 8-11,
+         // o1 has pixels 4-7 and 12-15
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store
+         if (step == 4) {
+            _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+            out += 64;
+         } else {
+            // each 16-byte store overlaps the next by 4 bytes; the last one
+            // is split so nothing is written past the 48 bytes of output
+            __m256i p0 = _mm256_shuffle_epi8(o0, rgb_shuf);
+            __m256i p1 = _mm256_shuffle_epi8(o1, rgb_shuf);
+            __m128i p3 = _mm256_extracti128_si256(p1, 1);
+            int tail = _mm_cvtsi128_si32(_mm_srli_si128(p3, 8));
+            _mm_storeu_si128((__m128i *) (out + 0), _mm256_castsi256_si128(p0));
+            _mm_storeu_si128((__m128i *) (out + 12), _mm256_castsi256_si128(p1));
+            _mm_storeu_si128((__m128i *) (out + 24), _mm256_extracti128_si256(p0, 1));
+            _mm_storel_epi64((__m128i *) (out + 36), p3);
+            memcpy(out + 44, &tail, 4);
+            out += 48;
+         }
+      }
+   }
+
+   // SSE2 handles the rest
+   if (i < count)
+      stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_block_x2_kernel = NULL;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
@@ -3778,11 +4365,59 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   if (stbi__avx2_available()) {
+      j->idct_block_x2_kernel = stbi__idct_avx2_x2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
+
+   j->idct_pending_out = NULL;
+   j->scale_shift = 0;
+   j->block_size = 8;
+}
+
+static int stbi__jpeg_scale_denom_global = 1;
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int denom)
+{
+   stbi__jpeg_scale_denom_global = denom;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_denom  stbi__jpeg_scale_denom_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_denom_local, stbi__jpeg_scale_denom_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denom)
+{
+   stbi__jpeg_scale_denom_local = denom;
+   stbi__jpeg_scale_denom_set = 1;
+}
+
+#define stbi__jpeg_scale_denom  (stbi__jpeg_scale_denom_set                     \
+                                  ? stbi__jpeg_scale_denom_local                \
+                                  : stbi__jpeg_scale_denom_global)
+#endif // STBI_THREAD_LOCAL
+
+// switch to the reduced IDCT for the requested scale, if any
+static void stbi__setup_jpeg_scale(stbi__jpeg *j, int denom)
+{
+   switch (denom) {
+      case 2: j->scale_shift = 1; j->idct_block_kernel = stbi__idct_block_4x4; break;
+      case 4: j->scale_shift = 2; j->idct_block_kernel = stbi__idct_block_2x2; break;
+      case 8: j->scale_shift = 3; j->idct_block_kernel = stbi__idct_block_1x1; break;
+      default: j->scale_shift = 0; break;
+   }
+   if (j->scale_shift)
+      j->idct_block_x2_kernel = NULL;
+   j->block_size = 8 >> j->scale_shift;
 }
 
 // clean up the temporary component buffers
@@ -3808,16 +4443,191 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// resample and color-convert rows [y0,y1) into output, which points at row
+// y0. res_comp holds the resampling state for row y0 and is advanced as we go.
+// note that with n==3 one byte past the last row gets written
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__resample *res_comp, stbi_uc **linebuf, stbi_uc *output,
+                                    int n, int decode_n, int is_rgb, unsigned int y0, unsigned int y1)
 {
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *out = output + n * z->s->img_x * (j - y0);
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+   }
+}
+
+// advance the resampling state by the given number of output rows without
+// producing them
+static void stbi__resample_skip_rows(stbi__resample *r, int comp_y, int w2, unsigned int rows)
+{
+   while (rows--) {
+      if (++r->ystep >= r->vs) {
+         r->ystep = 0;
+         r->line0 = r->line1;
+         if (++r->ypos < comp_y)
+            r->line1 += w2;
+      }
+   }
+}
+
+// color conversion is split into bands of whole MCU rows. each band needs its
+// own line buffers and resampling state, which is fast-forwarded to its first
+// row. the last row of a band is converted into scratch space and copied, so
+// the byte written past it doesn't race with the next band.
+#define STBI__MAX_CONVERT_TASKS 64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample *res_comp;
+   stbi_uc *scratch;
+   int band_scratch_size;
+   stbi_uc *output;
    int n, decode_n, is_rgb;
+   unsigned int rows_per_band;
+} stbi__jpeg_convert_job;
+
+static void stbi__jpeg_convert_task(void *task_data, int band)
+{
+   stbi__jpeg_convert_job *job = (stbi__jpeg_convert_job *) task_data;
+   stbi__jpeg *z = job->z;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4];
+   stbi_uc *scratch = job->scratch + (size_t) band * job->band_scratch_size;
+   stbi_uc *last_row = scratch + job->decode_n * (z->s->img_x + 3);
+   size_t row_size = (size_t) job->n * z->s->img_x;
+   unsigned int y0 = band * job->rows_per_band;
+   unsigned int y1 = y0 + job->rows_per_band;
+   int k;
+   STBI_TRACE_BEGIN("jpeg convert task");
+   if (y1 > z->s->img_y) y1 = z->s->img_y;
+   for (k=0; k < job->decode_n; ++k) {
+      res_comp[k] = job->res_comp[k];
+      stbi__resample_skip_rows(&res_comp[k], z->img_comp[k].y, z->img_comp[k].w2, y0);
+      linebuf[k] = scratch + k * (z->s->img_x + 3);
+   }
+   stbi__jpeg_convert_rows(z, res_comp, linebuf, job->output + row_size * y0, job->n, job->decode_n, job->is_rgb, y0, y1-1);
+   stbi__jpeg_convert_rows(z, res_comp, linebuf, last_row, job->n, job->decode_n, job->is_rgb, y1-1, y1);
+   memcpy(job->output + row_size * (y1-1), last_row, row_size);
+   STBI_TRACE_END();
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb, ok;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
 
    // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   STBI_TRACE_BEGIN("jpeg decode");
+   ok = stbi__decode_jpeg_image(z);
+   STBI_TRACE_END();
+   if (!ok) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // when decoding at a reduced size, everything from here on only sees the
+   // scaled image
+   if (z->scale_shift) {
+      int round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (n=0; n < z->s->img_n; ++n)
+         z->img_comp[n].y = (z->s->img_y * z->img_comp[n].v + z->img_v_max-1) / z->img_v_max;
+   }
 
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
@@ -3835,10 +4645,9 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
+      int k, num_bands = 1;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+      stbi__jpeg_convert_job job;
 
       stbi__resample res_comp[4];
 
@@ -3869,100 +4678,34 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
+      job.scratch = NULL;
+      if (stbi__parallel_for_func) {
+         unsigned int mcu_rows = z->img_mcu_h >> z->scale_shift;
+         unsigned int num_mcu_rows = (z->s->img_y + mcu_rows-1) / mcu_rows;
+         job.rows_per_band = mcu_rows * ((num_mcu_rows + STBI__MAX_CONVERT_TASKS-1) / STBI__MAX_CONVERT_TASKS);
+         num_bands = (z->s->img_y + job.rows_per_band-1) / job.rows_per_band;
+         // line buffers plus a spare output row, per band
+         job.band_scratch_size = decode_n * (z->s->img_x + 3) + n * z->s->img_x + 1;
+         if (num_bands > 1)
+            job.scratch = (stbi_uc *) stbi__malloc_mad2(num_bands, job.band_scratch_size, 0);
+      }
+      STBI_TRACE_BEGIN("jpeg color convert");
+      if (job.scratch) {
+         job.z = z;
+         job.res_comp = res_comp;
+         job.output = output;
+         job.n = n;
+         job.decode_n = decode_n;
+         job.is_rgb = is_rgb;
+         stbi__parallel_for(stbi__jpeg_convert_task, &job, num_bands);
+         STBI_FREE(job.scratch);
+      } else {
+         stbi_uc *linebuf[4];
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_convert_rows(z, res_comp, linebuf, output, n, decode_n, is_rgb, 0, z->s->img_y);
       }
+      STBI_TRACE_END();
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -3979,6 +4722,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   stbi__setup_jpeg_scale(j, stbi__jpeg_scale_denom);
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
    return result;
@@ -4035,6 +4779,10 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
+// wider tables for the fast inflate loop, see stbi__zbuild_wide
+#define STBI__ZWIDE_BITS  11
+#define STBI__ZWIDE_MASK  ((1 << STBI__ZWIDE_BITS) - 1)
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -4129,6 +4877,8 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+   stbi__uint32 zwide_length[1 << STBI__ZWIDE_BITS];
+   stbi__uint32 zwide_distance[1 << STBI__ZWIDE_BITS];
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -4237,11 +4987,209 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// Entries of the wide tables combine the code with what it decodes to, so
+// the fast loop needs a single lookup per literal, length or distance:
+//    bits  0-3   code length (0 if the code is longer than STBI__ZWIDE_BITS)
+//    bits  4-7   number of extra bits following the code
+//    bits 16-31  literal value, or base length/distance
+#define STBI__ZWIDE_LITERAL  0x100
+#define STBI__ZWIDE_END      0x200  // end of block
+#define STBI__ZWIDE_BAD      0x400  // symbol that never appears in valid data
+
+static stbi__uint32 stbi__zwide_entry(int sym, int len, int is_dist)
+{
+   stbi__uint32 e = (stbi__uint32) len;
+   if (is_dist) {
+      if (sym >= 30) return e | STBI__ZWIDE_BAD;
+      return e | (stbi__zdist_extra[sym] << 4) | ((stbi__uint32) stbi__zdist_base[sym] << 16);
+   }
+   if (sym < 256) return e | STBI__ZWIDE_LITERAL | ((stbi__uint32) sym << 16);
+   if (sym == 256) return e | STBI__ZWIDE_END;
+   if (sym >= 286) return e | STBI__ZWIDE_BAD;
+   sym -= 257;
+   return e | (stbi__zlength_extra[sym] << 4) | ((stbi__uint32) stbi__zlength_base[sym] << 16);
+}
+
+// sizelist must already have been validated by stbi__zbuild_huffman
+static void stbi__zbuild_wide(stbi__uint32 *table, const stbi_uc *sizelist, int num, int is_dist)
+{
+   int i, code = 0;
+   int next_code[16], sizes[16];
+
+   memset(sizes, 0, sizeof(sizes));
+   memset(table, 0, sizeof(*table) << STBI__ZWIDE_BITS);
+   for (i=0; i < num; ++i)
+      ++sizes[sizelist[i]];
+   sizes[0] = 0;
+   for (i=1; i < 16; ++i) {
+      next_code[i] = code;
+      code = (code + sizes[i]) << 1;
+   }
+   for (i=0; i < num; ++i) {
+      int s = sizelist[i];
+      if (s) {
+         if (s <= STBI__ZWIDE_BITS) {
+            stbi__uint32 e = stbi__zwide_entry(i, s, is_dist);
+            int j = stbi__bit_reverse(next_code[s], s);
+            for (; j < (1 << STBI__ZWIDE_BITS); j += 1 << s)
+               table[j] = e;
+         }
+         ++next_code[s];
+      }
+   }
+}
+
+// codes longer than the wide table, same as stbi__zhuffman_decode_slowpath
+static stbi__uint32 stbi__zwide_decode_long(stbi__zhuffman *z, stbi__uint64 bits, int is_dist)
+{
+   int b,s,k;
+   k = stbi__bit_reverse((int) (bits & 0xffff), 16);
+   for (s=STBI__ZFAST_BITS+1; ; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s >= 16) return STBI__ZWIDE_BAD;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b >= STBI__ZNSYMS || z->size[b] != s) return STBI__ZWIDE_BAD;
+   return stbi__zwide_entry(z->value[b], s, is_dist);
+}
+
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+   return  (stbi__uint64) p[0]        | ((stbi__uint64) p[1] <<  8) |
+          ((stbi__uint64) p[2] << 16) | ((stbi__uint64) p[3] << 24) |
+          ((stbi__uint64) p[4] << 32) | ((stbi__uint64) p[5] << 40) |
+          ((stbi__uint64) p[6] << 48) | ((stbi__uint64) p[7] << 56);
+}
+
+// the fast loop reads 8 bytes at a time, and writes whole matches plus up to
+// 7 bytes of overshoot from copying 8 bytes at a time
+#define STBI__ZFAST_INPUT_MARGIN   8
+#define STBI__ZFAST_OUTPUT_MARGIN  (258 + 8)
+
+// Decodes symbols with a 64-bit bit buffer for as long as there is enough
+// input and output space that no bounds checks are needed. Returns 2 at the
+// end of the block, 1 if the rest has to be done by the careful loop (near
+// the end of either buffer, or on something that looks corrupt), and 0 on
+// error.
+static int stbi__parse_huffman_block_fast(stbi__zbuf *a)
+{
+   // everything used in the loop is kept in locals, since stores through
+   // zout could alias anything in *a as far as the compiler knows
+   stbi_uc *in = a->zbuffer;
+   stbi_uc *in_end = a->zbuffer_end - STBI__ZFAST_INPUT_MARGIN;
+   char *zout = a->zout;
+   char *zout_start = a->zout_start;
+   char *zout_end = a->zout_end - STBI__ZFAST_OUTPUT_MARGIN;
+   const stbi__uint32 *lengths = a->zwide_length;
+   const stbi__uint32 *distances = a->zwide_distance;
+   stbi__uint64 bits = a->code_buffer;
+   int num_bits = a->num_bits;
+   int result = 1;
+
+   while (in <= in_end && zout <= zout_end) {
+      stbi__uint32 e;
+      int n, len, dist;
+      stbi_uc *p;
+
+      // refill to 56-63 bits. This also loads part of the next byte, but
+      // that's the same data the next refill ORs in again.
+      bits |= stbi__zload64(in) << num_bits;
+      in += (63 - num_bits) >> 3;
+      num_bits |= 56;
+
+      e = lengths[bits & STBI__ZWIDE_MASK];
+      if (!(e & 15)) e = stbi__zwide_decode_long(&a->z_length, bits, 0);
+      if (e & STBI__ZWIDE_LITERAL) {
+         // 56 bits is enough for three literals of up to 15 bits each, but
+         // not for a length and distance after two literals, so anything
+         // else goes back around for a refill
+         n = e & 15;
+         bits >>= n;
+         num_bits -= n;
+         *zout++ = (char) (e >> 16);
+         e = lengths[bits & STBI__ZWIDE_MASK];
+         if (e & STBI__ZWIDE_LITERAL) {
+            n = e & 15;
+            bits >>= n;
+            num_bits -= n;
+            *zout++ = (char) (e >> 16);
+            e = lengths[bits & STBI__ZWIDE_MASK];
+            if (e & STBI__ZWIDE_LITERAL) {
+               n = e & 15;
+               bits >>= n;
+               num_bits -= n;
+               *zout++ = (char) (e >> 16);
+            }
+         }
+         continue;
+      }
+      if (e & STBI__ZWIDE_BAD)
+         break; // let the careful loop report it
+      n = e & 15;
+      bits >>= n;
+      num_bits -= n;
+      if (e & STBI__ZWIDE_END) {
+         result = 2;
+         break;
+      }
+
+      // at most 15+5 bits used so far, which leaves enough for the distance
+      n = (e >> 4) & 15;
+      len = (int) (e >> 16) + (int) (bits & ((1 << n) - 1));
+      bits >>= n;
+      num_bits -= n;
+
+      e = distances[bits & STBI__ZWIDE_MASK];
+      if (!(e & 15)) e = stbi__zwide_decode_long(&a->z_distance, bits, 1);
+      if (e & STBI__ZWIDE_BAD) return stbi__err("bad huffman code","Corrupt PNG");
+      n = e & 15;
+      bits >>= n;
+      num_bits -= n;
+      n = (e >> 4) & 15;
+      dist = (int) (e >> 16) + (int) (bits & ((1 << n) - 1));
+      bits >>= n;
+      num_bits -= n;
+      if (zout - zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
+
+      p = (stbi_uc *) (zout - dist);
+      if (dist >= 8) {
+         // 8 byte chunks never overlap their own source, and the overshoot
+         // is inside the margin and gets overwritten later
+         char *end = zout + len;
+         do {
+            memcpy(zout, p, 8);
+            zout += 8;
+            p += 8;
+         } while (zout < end);
+         zout = end;
+      } else if (dist == 1) { // run of one byte; common in images.
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         do *zout++ = *p++; while (--len);
+      }
+   }
+
+   // hand back the bytes that were loaded but not consumed
+   a->zbuffer = in - (num_bits >> 3);
+   a->code_buffer = (stbi__uint32) (bits & ((1 << (num_bits & 7)) - 1));
+   a->num_bits = num_bits & 7;
+   a->zout = zout;
+   return result;
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      if (a->zbuffer_end - a->zbuffer >= STBI__ZFAST_INPUT_MARGIN && a->zout_end - zout >= STBI__ZFAST_OUTPUT_MARGIN) {
+         a->zout = zout;
+         z = stbi__parse_huffman_block_fast(a);
+         if (z != 1) return z != 0;
+         zout = a->zout;
+      }
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4326,6 +5274,8 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    if (n != ntot) return stbi__err("bad codelengths","Corrupt PNG");
    if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!stbi__zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   stbi__zbuild_wide(a->zwide_length, lencodes, hlit, 0);
+   stbi__zbuild_wide(a->zwide_distance, lencodes+hlit, hdist, 1);
    return 1;
 }
 
@@ -4420,6 +5370,8 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
             // use fixed code lengths
             if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , STBI__ZNSYMS)) return 0;
             if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+            stbi__zbuild_wide(a->zwide_length  , stbi__zdefault_length  , STBI__ZNSYMS, 0);
+            stbi__zbuild_wide(a->zwide_distance, stbi__zdefault_distance,  32, 1);
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
@@ -4588,6 +5540,116 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_SSE2
+static int stbi__png_load32(const stbi_uc *p, int n)
+{
+   int v = 0;
+   memcpy(&v, p, n);
+   return v;
+}
+
+// Sub, Avg and Paeth for 8-bit rows with 3 or 4 channels. Each pixel depends
+// on the one to its left, so this goes a pixel at a time with all channels
+// in 16-bit lanes of one register. cur, raw and prior point at the second
+// pixel of the row; the first one has already been done. A 3-channel pixel
+// is stored as 4 bytes, the last byte being either alpha or the start of the
+// next pixel (which gets overwritten right after), except at the end of the
+// row. Returns 0 if the filter isn't handled here.
+static int stbi__png_unfilter_sse2(stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int img_n, int out_n, int filter)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a, b, c, d, p;
+   int alpha = img_n != out_n ? (int) 0xff000000 : 0;
+   int has_prior = filter == STBI__F_avg || filter == STBI__F_paeth;
+   int i = 0;
+
+   // paeth(a,0,0) is always a
+   if (filter == STBI__F_paeth_first) filter = STBI__F_sub;
+   if (filter == STBI__F_avg_first) filter = STBI__F_avg;
+   if (filter != STBI__F_sub && filter != STBI__F_avg && filter != STBI__F_paeth)
+      return 0;
+   if (count <= 0)
+      return 1;
+
+   a = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__png_load32(cur - out_n, out_n)), zero);
+   b = c = zero;
+   if (has_prior)
+      b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__png_load32(prior - out_n, out_n)), zero);
+
+   if (filter == STBI__F_sub && img_n == out_n) {
+      // Sub is a running sum, so it can do four pixels at a time: add each
+      // pixel to the next, then each pair to the next pair, then add the
+      // last pixel of the previous group. Loads and stores are 16 bytes, so
+      // stop while that still fits in the row.
+      __m128i left = _mm_cvtsi32_si128(stbi__png_load32(cur - out_n, out_n));
+      if (img_n == 4) {
+         for (; i+4 <= count; i += 4, raw += 16, cur += 16, prior += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i *) raw);
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi8(x, _mm_shuffle_epi32(left, 0));
+            _mm_storeu_si128((__m128i *) cur, x);
+            left = _mm_srli_si128(x, 12);
+         }
+      } else {
+         __m128i mask = _mm_cvtsi32_si128(0xffffff);
+         for (; i+6 <= count; i += 4, raw += 12, cur += 12, prior += 12) {
+            __m128i x = _mm_loadu_si128((const __m128i *) raw);
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+            left = _mm_or_si128(left, _mm_slli_si128(left, 3));
+            left = _mm_or_si128(left, _mm_slli_si128(left, 6));
+            x = _mm_add_epi8(x, left);
+            // the top 4 bytes belong to the next pixels and get redone
+            _mm_storeu_si128((__m128i *) cur, x);
+            left = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+         }
+      }
+      a = _mm_unpacklo_epi8(left, zero);
+   }
+
+   for (; i < count; ++i, raw += img_n, cur += out_n, prior += out_n) {
+      // don't read or write past the end of the row on the last pixel
+      int last = i == count-1;
+      int v = last ? stbi__png_load32(raw, img_n) : stbi__png_load32(raw, 4);
+      d = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+      c = b;
+      if (has_prior)
+         b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(stbi__png_load32(prior, 4)), zero);
+
+      if (filter == STBI__F_sub) {
+         p = a;
+      } else if (filter == STBI__F_avg) {
+         p = _mm_srli_epi16(_mm_add_epi16(a, b), 1);
+      } else {
+         // p = a+b-c, so |p-a| = |b-c|, |p-b| = |a-c| and |p-c| = |b-c + a-c|
+         __m128i pa = _mm_sub_epi16(b, c);
+         __m128i pb = _mm_sub_epi16(a, c);
+         __m128i pc = _mm_add_epi16(pa, pb);
+         __m128i smallest, use_a, use_b;
+         pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+         pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+         pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+         smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+         // ties favor a, then b
+         use_a = _mm_cmpeq_epi16(smallest, pa);
+         use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));
+         p = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(use_a, use_b), c),
+             _mm_or_si128(_mm_and_si128(use_a, a), _mm_and_si128(use_b, b)));
+      }
+
+      // byte add so each channel wraps around, leaving the high bytes zero
+      a = _mm_add_epi8(d, p);
+      v = _mm_cvtsi128_si32(_mm_packus_epi16(a, a)) | alpha;
+      if (last)
+         memcpy(cur, &v, out_n);
+      else
+         memcpy(cur, &v, 4);
+   }
+   return 1;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4603,6 +5665,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+#ifdef STBI_SSE2
+   int use_sse2 = depth == 8 && (img_n == 3 || img_n == 4) && stbi__sse2_available();
+#endif
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4669,6 +5734,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          prior += 1;
       }
 
+#ifdef STBI_SSE2
+      if (use_sse2 && stbi__png_unfilter_sse2(cur, raw, prior, x-1, img_n, out_n, filter)) {
+         raw += (x-1)*img_n;
+      } else
+#endif
       // this is a little gross, so that we don't switch per-pixel or per-component
       if (depth < 8 || img_n == out_n) {
          int nk = (width - 1)*filter_bytes;
@@ -5026,7 +6096,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    stbi_uc has_trans=0, tc[3]={0};
    stbi__uint16 tc16[3];
    stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0;
-   int first=1,k,interlace=0, color=0, is_iphone=0;
+   int first=1,k,interlace=0, color=0, is_iphone=0, ok;
    stbi__context *s = z->s;
 
    z->expanded = NULL;
@@ -5140,14 +6210,19 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+            STBI_TRACE_BEGIN("png inflate");
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            STBI_TRACE_END();
             if (z->expanded == NULL) return 0; // zlib should set error
             STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            STBI_TRACE_BEGIN("png unfilter");
+            ok = stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace);
+            STBI_TRACE_END();
+            if (!ok) return 0;
             if (has_trans) {
                if (z->depth == 16) {
                   if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
@@ -32,6 +32,13 @@ BUILDING:
    The returned data will be freed with STBIW_FREE() (free() by default),
    so it must be heap allocated with STBIW_MALLOC() (malloc() by default),
 
+   On x86/x64 builds with SSE2 enabled, the JPEG writer's forward DCT and
+   RGB->YCbCr conversion use SSE2, plus AVX2 versions compiled with target
+   attributes and only used if the CPU reports AVX2 at run-time. They do the
+   scalar code's float operations in the same order, so the output is the
+   same unless the compiler contracts the scalar code into FMAs. Define
+   STBIW_NO_SIMD to leave them out, or STBIW_NO_AVX2 to only leave out AVX2.
+
 UNICODE:
 
    If compiling for Windows and you wish to use Unicode filenames, compile
@@ -68,6 +75,7 @@ USAGE:
       int stbi_write_tga_with_rle;             // defaults to true; set to 0 to disable RLE
       int stbi_write_png_compression_level;    // defaults to 8; set to higher for more compression
       int stbi_write_force_png_filter;         // defaults to -1; set to 0..5 to force a filter mode
+      int stbi_write_png_fast;                 // defaults to 0; set to 1 to trade compression for speed
 
 
    You can define STBI_WRITE_NO_STDIO to disable the file variant of these
@@ -99,6 +107,14 @@ USAGE:
    PNG allows you to set the deflate compression level by setting the global
    variable 'stbi_write_png_compression_level' (it defaults to 8).
 
+   Setting 'stbi_write_png_fast' to 1 trades some compression for speed. Each
+   row's filter is then picked from a sample of its bytes instead of trying
+   all five on the whole row, and the rows are deflated in independent bands
+   of about 1MB, joined with sync flushes into a single IDAT. The bands run on
+   the caller's threads if stbi_write_set_parallel_for was called. The
+   compression level still sets the speed/ratio tradeoff, and can go down to
+   1 instead of 5 in this mode.
+
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
    replicated across all three channels.
@@ -110,6 +126,12 @@ USAGE:
    Higher quality looks better but results in a bigger image.
    JPEG baseline (no JPEG progressive).
 
+   The JPEG encoder can be split across the caller's threads by calling
+   stbi_write_set_parallel_for (see its declaration below). The image is then
+   cut into horizontal stripes separated by restart markers, which are
+   encoded independently and written out in order. Small images, and any
+   image when no parallel_for is set, are written exactly as before.
+
 CREDITS:
 
 
@@ -170,6 +192,7 @@ LICENSE
 STBIWDEF int stbi_write_tga_with_rle;
 STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
+STBIWDEF int stbi_write_png_fast;
 #endif
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -194,6 +217,14 @@ STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x,
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
+// run independent pieces of JPEG and fast PNG encoding work (stripes of the
+// image) on the caller's threads. parallel_for must call task(task_data, i) for every i in
+// [0,count) and only return once all of them have finished. by default
+// everything runs on the calling thread.
+typedef void stbi_write_parallel_task(void *task_data, int index);
+typedef void stbi_write_parallel_for_func(void *user, stbi_write_parallel_task *task, void *task_data, int count);
+STBIWDEF void stbi_write_set_parallel_for(stbi_write_parallel_for_func *parallel_for, void *user);
+
 #endif//INCLUDE_STB_IMAGE_WRITE_H
 
 #ifdef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -247,14 +278,58 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+// SSE2 is only used where the compiler may already assume it, so there's no
+// run-time test for it
+#if !defined(STBIW_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBIW_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 can't be assumed the way SSE2 is on x64, so those kernels are built
+// with a target attribute (GCC/Clang) and picked at run-time.
+#if defined(STBIW_SSE2) && !defined(STBIW_NO_AVX2)
+#if (defined(_MSC_VER) && _MSC_VER >= 1700) || defined(__clang__) || \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define STBIW_AVX2
+#endif
+#endif
+
+#ifdef STBIW_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid
+#define STBIW__AVX2_TARGET
+static int stbiw__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,1);
+   // AVX and OSXSAVE, and the OS saves the YMM registers on context switch
+   if ((info[2] & (3 << 27)) != (3 << 27) || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define STBIW__AVX2_TARGET __attribute__((target("avx2")))
+static int stbiw__avx2_available(void)
+{
+   // also checks that the OS has enabled the YMM state
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif // STBIW_AVX2
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
 static int stbi_write_force_png_filter = -1;
+static int stbi_write_png_fast = 0;
 #else
 int stbi_write_png_compression_level = 8;
 int stbi_write_tga_with_rle = 1;
 int stbi_write_force_png_filter = -1;
+int stbi_write_png_fast = 0;
 #endif
 
 static int stbi__flip_vertically_on_write = 0;
@@ -264,6 +339,26 @@ STBIWDEF void stbi_flip_vertically_on_write(int flag)
    stbi__flip_vertically_on_write = flag;
 }
 
+static stbi_write_parallel_for_func *stbiw__parallel_for_func;
+static void *stbiw__parallel_for_user;
+
+STBIWDEF void stbi_write_set_parallel_for(stbi_write_parallel_for_func *parallel_for, void *user)
+{
+   stbiw__parallel_for_func = parallel_for;
+   stbiw__parallel_for_user = user;
+}
+
+static void stbiw__parallel_for(stbi_write_parallel_task *task, void *task_data, int count)
+{
+   if (stbiw__parallel_for_func && count > 1) {
+      stbiw__parallel_for_func(stbiw__parallel_for_user, task, task_data, count);
+   } else {
+      int i;
+      for (i=0; i < count; ++i)
+         task(task_data, i);
+   }
+}
+
 typedef struct
 {
    stbi_write_func *func;
@@ -892,27 +987,26 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #endif // STBIW_ZLIB_COMPRESS
 
-STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+#ifndef STBIW_ZLIB_COMPRESS
+// appends data to out as deflate blocks, ending on a byte boundary. unless
+// final is set, the last block isn't marked as such and is followed by an
+// empty stored block (a sync flush), so more blocks can be appended.
+static int stbiw__zlib_deflate(unsigned char **out_p, unsigned char *data, int data_len, int quality, int final)
 {
-#ifdef STBIW_ZLIB_COMPRESS
-   // user provided a zlib compress implementation, use that
-   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
-#else // use builtin
    static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
    static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
    static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
    static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
    unsigned int bitbuf=0;
    int i,j, bitcount=0;
-   unsigned char *out = NULL;
+   unsigned char *out = *out_p;
+   int start = stbiw__sbcount(out);
    unsigned char ***hash_table = (unsigned char***) STBIW_MALLOC(stbiw__ZHASH * sizeof(unsigned char**));
    if (hash_table == NULL)
-      return NULL;
-   if (quality < 5) quality = 5;
+      return 0;
+   if (quality < 1) quality = 1;
 
-   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
-   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
-   stbiw__zlib_add(1,1);  // BFINAL = 1
+   stbiw__zlib_add(final ? 1 : 0,1);  // BFINAL
    stbiw__zlib_add(1,2);  // BTYPE = 1 -- fixed huffman
 
    for (i=0; i < stbiw__ZHASH; ++i)
@@ -973,21 +1067,30 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
    for (;i < data_len; ++i)
       stbiw__zlib_huffb(data[i]);
    stbiw__zlib_huff(256); // end of block
+   if (!final)
+      stbiw__zlib_add(0,3); // BFINAL = 0, BTYPE = 0 -- empty stored block
    // pad with 0 bits to byte boundary
    while (bitcount)
       stbiw__zlib_add(0,1);
+   if (!final) {
+      stbiw__sbpush(out, 0x00); // LEN
+      stbiw__sbpush(out, 0x00);
+      stbiw__sbpush(out, 0xff); // NLEN
+      stbiw__sbpush(out, 0xff);
+   }
 
    for (i=0; i < stbiw__ZHASH; ++i)
       (void) stbiw__sbfree(hash_table[i]);
    STBIW_FREE(hash_table);
 
-   // store uncompressed instead if compression was worse
-   if (stbiw__sbn(out) > data_len + 2 + ((data_len+32766)/32767)*5) {
-      stbiw__sbn(out) = 2;  // truncate to DEFLATE 32K window and FLEVEL = 1
+   // store uncompressed instead if compression was worse. stored blocks
+   // end on a byte boundary anyway, so they need no sync flush
+   if (stbiw__sbn(out) - start > data_len + ((data_len+32766)/32767)*5) {
+      stbiw__sbn(out) = start;  // truncate to what was there before
       for (j = 0; j < data_len;) {
          int blocklen = data_len - j;
          if (blocklen > 32767) blocklen = 32767;
-         stbiw__sbpush(out, data_len - j == blocklen); // BFINAL = ?, BTYPE = 0 -- no compression
+         stbiw__sbpush(out, final && data_len - j == blocklen); // BFINAL = ?, BTYPE = 0 -- no compression
          stbiw__sbpush(out, STBIW_UCHAR(blocklen)); // LEN
          stbiw__sbpush(out, STBIW_UCHAR(blocklen >> 8));
          stbiw__sbpush(out, STBIW_UCHAR(~blocklen)); // NLEN
@@ -997,23 +1100,62 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
          j += blocklen;
       }
    }
+   *out_p = out;
+   return 1;
+}
 
-   {
-      // compute adler32 on input
-      unsigned int s1=1, s2=0;
-      int blocklen = (int) (data_len % 5552);
-      j=0;
-      while (j < data_len) {
-         for (i=0; i < blocklen; ++i) { s1 += data[j+i]; s2 += s1; }
-         s1 %= 65521; s2 %= 65521;
-         j += blocklen;
-         blocklen = 5552;
-      }
-      stbiw__sbpush(out, STBIW_UCHAR(s2 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s2));
-      stbiw__sbpush(out, STBIW_UCHAR(s1 >> 8));
-      stbiw__sbpush(out, STBIW_UCHAR(s1));
+static unsigned int stbiw__adler32(unsigned char *data, int data_len)
+{
+   unsigned int s1=1, s2=0;
+   int i, j=0, blocklen = (int) (data_len % 5552);
+   while (j < data_len) {
+      for (i=0; i < blocklen; ++i) { s1 += data[j+i]; s2 += s1; }
+      s1 %= 65521; s2 %= 65521;
+      j += blocklen;
+      blocklen = 5552;
    }
+   return (s2 << 16) | s1;
+}
+
+// adler32 of two pieces of data joined together, from the adler32 of each
+// and the length of the second
+static unsigned int stbiw__adler32_combine(unsigned int adler1, unsigned int adler2, int len2)
+{
+   unsigned int rem = (unsigned int) (len2 % 65521);
+   unsigned int s1 = adler1 & 0xffff, s2 = (rem * s1) % 65521;
+   s1 += (adler2 & 0xffff) + 65521 - 1;
+   s2 += (adler1 >> 16) + (adler2 >> 16) + 65521 - rem;
+   if (s1 >= 65521) s1 -= 65521;
+   if (s1 >= 65521) s1 -= 65521;
+   if (s2 >= 65521*2) s2 -= 65521*2;
+   if (s2 >= 65521) s2 -= 65521;
+   return (s2 << 16) | s1;
+}
+#endif // STBIW_ZLIB_COMPRESS
+
+STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+#ifdef STBIW_ZLIB_COMPRESS
+   // user provided a zlib compress implementation, use that
+   return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
+#else // use builtin
+   unsigned char *out = NULL;
+   unsigned int adler;
+   if (quality < 5) quality = 5;
+
+   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
+   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
+   if (!stbiw__zlib_deflate(&out, data, data_len, quality, 1)) {
+      (void) stbiw__sbfree(out);
+      return NULL;
+   }
+
+   // compute adler32 on input
+   adler = stbiw__adler32(data, data_len);
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 24));
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 16));
+   stbiw__sbpush(out, STBIW_UCHAR(adler >> 8));
+   stbiw__sbpush(out, STBIW_UCHAR(adler));
    *out_len = stbiw__sbn(out);
    // make returned pointer freeable
    STBIW_MEMMOVE(stbiw__sbraw(out), out, *out_len);
@@ -1125,6 +1267,125 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
    }
 }
 
+#ifndef STBIW_ZLIB_COMPRESS
+// rows are filtered and deflated in bands of about this many bytes
+#define STBIW__PNG_BAND_BYTES (1 << 20)
+
+// cheap stand-in for trying all five filters on the whole row: sums the same
+// estimate over a few hundred bytes spread evenly across it
+static int stbiw__png_pick_filter(unsigned char *z, int signed_stride, int width, int n)
+{
+   int est[5] = { 0,0,0,0,0 };
+   int i, f, best = 0, count = width*n;
+   int step = count / 256 > 1 ? count / 256 : 1;
+   for (i = n; i < count; i += step) {
+      int a = z[i-n], b = z[i-signed_stride], c = z[i-signed_stride-n];
+      est[0] += abs((signed char) z[i]);
+      est[1] += abs((signed char) (z[i] - a));
+      est[2] += abs((signed char) (z[i] - b));
+      est[3] += abs((signed char) (z[i] - ((a + b) >> 1)));
+      est[4] += abs((signed char) (z[i] - stbiw__paeth(a, b, c)));
+   }
+   for (f = 1; f < 5; ++f)
+      if (est[f] < est[best]) best = f;
+   return best;
+}
+
+typedef struct
+{
+   unsigned char *pixels;
+   int stride_bytes, x, y, n, force_filter, quality, band_rows;
+   unsigned char **zlib;   // deflate blocks of each band, NULL if it failed
+   unsigned int *adler;    // adler32 of each band's filtered rows
+} stbiw__png_band_job;
+
+static void stbiw__png_band_task(void *task_data, int i)
+{
+   stbiw__png_band_job *job = (stbiw__png_band_job *) task_data;
+   int row_bytes = job->x*job->n + 1;
+   int y0 = i * job->band_rows, y1 = y0 + job->band_rows, j;
+   unsigned char *filt;
+   if (y1 > job->y) y1 = job->y;
+   job->zlib[i] = NULL;
+   filt = (unsigned char *) STBIW_MALLOC(row_bytes * (y1 - y0));
+   if (!filt) return;
+   for (j = y0; j < y1; ++j) {
+      unsigned char *row = filt + (j-y0)*row_bytes;
+      int filter_type = job->force_filter;
+      if (filter_type < 0) {
+         int signed_stride = stbi__flip_vertically_on_write ? -job->stride_bytes : job->stride_bytes;
+         unsigned char *z = job->pixels + job->stride_bytes * (stbi__flip_vertically_on_write ? job->y-1-j : j);
+         // there's no previous row to compare against on the first one
+         filter_type = j == 0 ? 1 : stbiw__png_pick_filter(z, signed_stride, job->x, job->n);
+      }
+      row[0] = (unsigned char) filter_type;
+      stbiw__encode_png_line(job->pixels, job->stride_bytes, job->x, job->y, j, job->n, filter_type, (signed char *) row + 1);
+   }
+   // leaves zlib[i] NULL if it fails
+   stbiw__zlib_deflate(&job->zlib[i], filt, row_bytes * (y1 - y0), job->quality, y1 == job->y);
+   job->adler[i] = stbiw__adler32(filt, row_bytes * (y1 - y0));
+   STBIW_FREE(filt);
+}
+
+// filters and compresses the image in independent bands, which can run in
+// parallel. returns the zlib stream, freeable with STBIW_FREE
+static unsigned char *stbiw__png_zlib_fast(unsigned char *pixels, int stride_bytes, int x, int y, int n, int force_filter, int *out_len)
+{
+   stbiw__png_band_job job;
+   int row_bytes = x*n + 1;
+   int num_bands, i, len = 2 + 4;
+   unsigned int adler = 1;
+   unsigned char *out = NULL, *o;
+
+   job.pixels = pixels;
+   job.stride_bytes = stride_bytes;
+   job.x = x;
+   job.y = y;
+   job.n = n;
+   job.force_filter = force_filter;
+   job.quality = stbi_write_png_compression_level;
+   job.band_rows = STBIW__PNG_BAND_BYTES / row_bytes > 1 ? STBIW__PNG_BAND_BYTES / row_bytes : 1;
+   num_bands = (y + job.band_rows-1) / job.band_rows;
+   job.zlib = (unsigned char **) STBIW_MALLOC(num_bands * sizeof(unsigned char *));
+   job.adler = (unsigned int *) STBIW_MALLOC(num_bands * sizeof(unsigned int));
+   if (!job.zlib || !job.adler) {
+      STBIW_FREE(job.zlib);
+      STBIW_FREE(job.adler);
+      return NULL;
+   }
+
+   stbiw__parallel_for(stbiw__png_band_task, &job, num_bands);
+
+   for (i=0; i < num_bands; ++i) {
+      int band_len = job.band_rows * row_bytes;
+      if (!job.zlib[i]) len = -1;
+      if (len < 0) continue;
+      len += stbiw__sbn(job.zlib[i]);
+      if (i == num_bands-1) band_len = (y - i*job.band_rows) * row_bytes;
+      adler = stbiw__adler32_combine(adler, job.adler[i], band_len);
+   }
+   if (len >= 0)
+      out = (unsigned char *) STBIW_MALLOC(len);
+   if (out) {
+      o = out;
+      *o++ = 0x78;   // DEFLATE 32K window
+      *o++ = 0x5e;   // FLEVEL = 1
+      for (i=0; i < num_bands; ++i) {
+         STBIW_MEMMOVE(o, job.zlib[i], stbiw__sbn(job.zlib[i]));
+         o += stbiw__sbn(job.zlib[i]);
+      }
+      stbiw__wp32(o, adler);
+      STBIW_ASSERT(o == out + len);
+      *out_len = len;
+   }
+   for (i=0; i < num_bands; ++i)
+      (void) stbiw__sbfree(job.zlib[i]);
+   STBIW_FREE(job.zlib);
+   STBIW_FREE(job.adler);
+   return out;
+}
+#endif // STBIW_ZLIB_COMPRESS
+
 STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
 {
    int force_filter = stbi_write_force_png_filter;
@@ -1141,40 +1402,47 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
       force_filter = -1;
    }
 
-   filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
-   line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
-   for (j=0; j < y; ++j) {
-      int filter_type;
-      if (force_filter > -1) {
-         filter_type = force_filter;
-         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
-      } else { // Estimate the best filter by running through all of them:
-         int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-         for (filter_type = 0; filter_type < 5; filter_type++) {
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-            // Estimate the entropy of the line using this filter; the less, the better.
-            est = 0;
-            for (i = 0; i < x*n; ++i) {
-               est += abs((signed char) line_buffer[i]);
+#ifndef STBIW_ZLIB_COMPRESS
+   if (stbi_write_png_fast) {
+      zlib = stbiw__png_zlib_fast((unsigned char *) pixels, stride_bytes, x, y, n, force_filter, &zlen);
+   } else
+#endif
+   {
+      filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
+      line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
+      for (j=0; j < y; ++j) {
+         int filter_type;
+         if (force_filter > -1) {
+            filter_type = force_filter;
+            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
+         } else { // Estimate the best filter by running through all of them:
+            int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
+            for (filter_type = 0; filter_type < 5; filter_type++) {
+               stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
+
+               // Estimate the entropy of the line using this filter; the less, the better.
+               est = 0;
+               for (i = 0; i < x*n; ++i) {
+                  est += abs((signed char) line_buffer[i]);
+               }
+               if (est < best_filter_val) {
+                  best_filter_val = est;
+                  best_filter = filter_type;
+               }
             }
-            if (est < best_filter_val) {
-               best_filter_val = est;
-               best_filter = filter_type;
+            if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
+               stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
+               filter_type = best_filter;
             }
          }
-         if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
-            filter_type = best_filter;
-         }
+         // when we get here, filter_type contains the filter type, and line_buffer contains the data
+         filt[j*(x*n+1)] = (unsigned char) filter_type;
+         STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
       }
-      // when we get here, filter_type contains the filter type, and line_buffer contains the data
-      filt[j*(x*n+1)] = (unsigned char) filter_type;
-      STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
+      STBIW_FREE(line_buffer);
+      zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
+      STBIW_FREE(filt);
    }
-   STBIW_FREE(line_buffer);
-   zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
-   STBIW_FREE(filt);
    if (!zlib) return 0;
 
    // each tag requires 12 bytes of overhead
@@ -1325,11 +1593,10 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
-   int dataOff, i, j, n, diff, end0pos, x, y;
-   int DU[64];
+// DCT of the 8x8 block at CDU (which it overwrites), quantized by fdtbl and
+// stored to DU in zigzag order
+static void stbiw__jpg_fdct(int *DU, float *CDU, int du_stride, const float *fdtbl) {
+   int dataOff, i, j, n, x, y;
 
    // DCT rows
    for(dataOff=0, n=du_stride*8; dataOff<n; dataOff+=du_stride) {
@@ -1351,6 +1618,236 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
          DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
       }
    }
+}
+
+static void stbiw__jpg_RGB_to_YCbCr_row(float *Y, float *U, float *V, const unsigned char *p, int comp, int count) {
+   // comp == 2 is grey+alpha (alpha is ignored)
+   int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+   int i;
+   for(i = 0; i < count; ++i, p += comp) {
+      float r = p[0], g = p[ofsG], b = p[ofsB];
+      Y[i]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+      U[i]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+      V[i]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+   }
+}
+
+#ifdef STBIW_SSE2
+// one pass of stbiw__jpg_DCT over 8 vectors, with the same operations in the
+// same order, so every lane matches the scalar code exactly
+#define STBIW__JPG_DCT_SIMD(T, add, sub, mul, set1, d) { \
+   T tmp0 = add(d[0], d[7]), tmp7 = sub(d[0], d[7]); \
+   T tmp1 = add(d[1], d[6]), tmp6 = sub(d[1], d[6]); \
+   T tmp2 = add(d[2], d[5]), tmp5 = sub(d[2], d[5]); \
+   T tmp3 = add(d[3], d[4]), tmp4 = sub(d[3], d[4]); \
+   T tmp10 = add(tmp0, tmp3), tmp13 = sub(tmp0, tmp3); \
+   T tmp11 = add(tmp1, tmp2), tmp12 = sub(tmp1, tmp2); \
+   T z1, z2, z3, z4, z5, z11, z13; \
+   d[0] = add(tmp10, tmp11); \
+   d[4] = sub(tmp10, tmp11); \
+   z1 = mul(add(tmp12, tmp13), set1(0.707106781f)); \
+   d[2] = add(tmp13, z1); \
+   d[6] = sub(tmp13, z1); \
+   tmp10 = add(tmp4, tmp5); \
+   tmp11 = add(tmp5, tmp6); \
+   tmp12 = add(tmp6, tmp7); \
+   z5 = mul(sub(tmp10, tmp12), set1(0.382683433f)); \
+   z2 = add(mul(tmp10, set1(0.541196100f)), z5); \
+   z4 = add(mul(tmp12, set1(1.306562965f)), z5); \
+   z3 = mul(tmp11, set1(0.707106781f)); \
+   z11 = add(tmp7, z3); \
+   z13 = sub(tmp7, z3); \
+   d[5] = add(z13, z2); \
+   d[3] = sub(z13, z2); \
+   d[1] = add(z11, z4); \
+   d[7] = sub(z11, z4); \
+}
+
+// the scalar code's conversion, one lane per pixel
+#define STBIW__JPG_YCBCR_SIMD(add, sub, mul, set1, r, g, b, y, u, v) { \
+   y = sub(add(add(mul(set1(+0.29900f), r), mul(set1(0.58700f), g)), mul(set1(0.11400f), b)), set1(128.0f)); \
+   u = add(sub(mul(set1(-0.16874f), r), mul(set1(0.33126f), g)), mul(set1(0.50000f), b)); \
+   v = sub(sub(mul(set1(+0.50000f), r), mul(set1(0.41869f), g)), mul(set1(0.08131f), b)); \
+}
+
+// transposes the 8x8 block held in r[row][half], one 4x4 quarter at a time
+static void stbiw__jpg_transpose_sse2(__m128 r[8][2])
+{
+   __m128 t;
+   _MM_TRANSPOSE4_PS(r[0][0], r[1][0], r[2][0], r[3][0]);
+   _MM_TRANSPOSE4_PS(r[0][1], r[1][1], r[2][1], r[3][1]);
+   _MM_TRANSPOSE4_PS(r[4][0], r[5][0], r[6][0], r[7][0]);
+   _MM_TRANSPOSE4_PS(r[4][1], r[5][1], r[6][1], r[7][1]);
+   t = r[0][1]; r[0][1] = r[4][0]; r[4][0] = t;
+   t = r[1][1]; r[1][1] = r[5][0]; r[5][0] = t;
+   t = r[2][1]; r[2][1] = r[6][0]; r[6][0] = t;
+   t = r[3][1]; r[3][1] = r[7][0]; r[7][0] = t;
+}
+
+// the block is transposed so the row DCTs become a vertical pass too, and
+// transposed back for the column DCTs
+static void stbiw__jpg_fdct_sse2(int *DU, float *CDU, int du_stride, const float *fdtbl) {
+   __m128 r[8][2], d[8];
+   __m128 half = _mm_set1_ps(0.5f), sign_bit = _mm_set1_ps(-0.0f);
+   int i, h, q[64];
+
+   for(i = 0; i < 8; ++i) {
+      r[i][0] = _mm_loadu_ps(CDU + i*du_stride);
+      r[i][1] = _mm_loadu_ps(CDU + i*du_stride + 4);
+   }
+   stbiw__jpg_transpose_sse2(r);
+   for(h = 0; h < 2; ++h) {
+      for(i = 0; i < 8; ++i) d[i] = r[i][h];
+      STBIW__JPG_DCT_SIMD(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, d);
+      for(i = 0; i < 8; ++i) r[i][h] = d[i];
+   }
+   stbiw__jpg_transpose_sse2(r);
+   for(h = 0; h < 2; ++h) {
+      for(i = 0; i < 8; ++i) d[i] = r[i][h];
+      STBIW__JPG_DCT_SIMD(__m128, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, d);
+      // Quantize, rounding half away from zero like the scalar code
+      for(i = 0; i < 8; ++i) {
+         __m128 v = _mm_mul_ps(d[i], _mm_loadu_ps(fdtbl + i*8 + h*4));
+         v = _mm_add_ps(v, _mm_or_ps(half, _mm_and_ps(v, sign_bit)));
+         _mm_storeu_si128((__m128i *) (q + i*8 + h*4), _mm_cvttps_epi32(v));
+      }
+   }
+   for(i = 0; i < 64; ++i) {
+      DU[stbiw__jpg_ZigZag[i]] = q[i];
+   }
+}
+
+static void stbiw__jpg_RGB_to_YCbCr_sse2(float *Y, float *U, float *V, const unsigned char *p, int comp, int count) {
+   int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+   int i = 0;
+   for(; i+4 <= count; i += 4, p += 4*comp) {
+      __m128i ri, gi, bi;
+      __m128 r, g, b, y, u, v;
+      if (comp == 4) {
+         __m128i x = _mm_loadu_si128((const __m128i *) p);
+         __m128i mask = _mm_set1_epi32(0xff);
+         ri = _mm_and_si128(x, mask);
+         gi = _mm_and_si128(_mm_srli_epi32(x, 8), mask);
+         bi = _mm_and_si128(_mm_srli_epi32(x, 16), mask);
+      } else {
+         ri = _mm_setr_epi32(p[0], p[comp], p[2*comp], p[3*comp]);
+         gi = _mm_setr_epi32(p[ofsG], p[comp+ofsG], p[2*comp+ofsG], p[3*comp+ofsG]);
+         bi = _mm_setr_epi32(p[ofsB], p[comp+ofsB], p[2*comp+ofsB], p[3*comp+ofsB]);
+      }
+      r = _mm_cvtepi32_ps(ri);
+      g = _mm_cvtepi32_ps(gi);
+      b = _mm_cvtepi32_ps(bi);
+      STBIW__JPG_YCBCR_SIMD(_mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, r, g, b, y, u, v);
+      _mm_storeu_ps(Y+i, y);
+      _mm_storeu_ps(U+i, u);
+      _mm_storeu_ps(V+i, v);
+   }
+   stbiw__jpg_RGB_to_YCbCr_row(Y+i, U+i, V+i, p, comp, count-i);
+}
+#endif // STBIW_SSE2
+
+#ifdef STBIW_AVX2
+static STBIW__AVX2_TARGET void stbiw__jpg_transpose_avx2(__m256 r[8])
+{
+   __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+   __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+   __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+   __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+   __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0)), s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+   __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0)), s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+   __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0)), s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+   __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0)), s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+   r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+   r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+   r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+   r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+   r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+   r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+   r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+   r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+// same as the SSE2 version, with a whole row of the block per register
+static STBIW__AVX2_TARGET void stbiw__jpg_fdct_avx2(int *DU, float *CDU, int du_stride, const float *fdtbl) {
+   __m256 d[8];
+   __m256 half = _mm256_set1_ps(0.5f), sign_bit = _mm256_set1_ps(-0.0f);
+   int i, q[64];
+
+   for(i = 0; i < 8; ++i) {
+      d[i] = _mm256_loadu_ps(CDU + i*du_stride);
+   }
+   stbiw__jpg_transpose_avx2(d);
+   STBIW__JPG_DCT_SIMD(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, d);
+   stbiw__jpg_transpose_avx2(d);
+   STBIW__JPG_DCT_SIMD(__m256, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, d);
+   for(i = 0; i < 8; ++i) {
+      __m256 v = _mm256_mul_ps(d[i], _mm256_loadu_ps(fdtbl + i*8));
+      v = _mm256_add_ps(v, _mm256_or_ps(half, _mm256_and_ps(v, sign_bit)));
+      _mm256_storeu_si256((__m256i *) (q + i*8), _mm256_cvttps_epi32(v));
+   }
+   for(i = 0; i < 64; ++i) {
+      DU[stbiw__jpg_ZigZag[i]] = q[i];
+   }
+}
+
+// 8 pixels per iteration. RGB and RGBA are spread out to one pixel per 32-bit
+// lane with byte shuffles
+static STBIW__AVX2_TARGET void stbiw__jpg_RGB_to_YCbCr_avx2(float *Y, float *U, float *V, const unsigned char *p, int comp, int count) {
+   int i = 0;
+   __m256i mask = _mm256_set1_epi32(0xff);
+   for(; i+8 <= count; i += 8, p += 8*comp) {
+      __m256i ri, gi, bi;
+      __m256 r, g, b, y, u, v;
+      if (comp == 3 || comp == 4) {
+         __m256i x;
+         if (comp == 4) {
+            x = _mm256_loadu_si256((const __m256i *) p);
+         } else {
+            // pixels 0-3 from bytes 0-11 and 4-7 from bytes 12-23, without
+            // reading past the last pixel
+            __m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p),
+                                          _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1));
+            __m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p+8)),
+                                          _mm_setr_epi8(4,5,6,-1, 7,8,9,-1, 10,11,12,-1, 13,14,15,-1));
+            x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+         }
+         ri = _mm256_and_si256(x, mask);
+         gi = _mm256_and_si256(_mm256_srli_epi32(x, 8), mask);
+         bi = _mm256_and_si256(_mm256_srli_epi32(x, 16), mask);
+      } else {
+         // grey, or grey+alpha
+         ri = _mm256_setr_epi32(p[0], p[comp], p[2*comp], p[3*comp], p[4*comp], p[5*comp], p[6*comp], p[7*comp]);
+         gi = bi = ri;
+      }
+      r = _mm256_cvtepi32_ps(ri);
+      g = _mm256_cvtepi32_ps(gi);
+      b = _mm256_cvtepi32_ps(bi);
+      STBIW__JPG_YCBCR_SIMD(_mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, r, g, b, y, u, v);
+      _mm256_storeu_ps(Y+i, y);
+      _mm256_storeu_ps(U+i, u);
+      _mm256_storeu_ps(V+i, v);
+   }
+   stbiw__jpg_RGB_to_YCbCr_sse2(Y+i, U+i, V+i, p, comp, count-i);
+}
+#endif // STBIW_AVX2
+
+typedef struct
+{
+   const unsigned char *data;
+   int width, height, comp, subsample;
+   const float *fdtbl_Y, *fdtbl_UV;
+   const unsigned short (*YDC_HT)[2], (*UVDC_HT)[2], (*YAC_HT)[2], (*UVAC_HT)[2];
+   void (*fdct_kernel)(int *DU, float *CDU, int du_stride, const float *fdtbl);
+   void (*RGB_to_YCbCr_kernel)(float *Y, float *U, float *V, const unsigned char *p, int comp, int count);
+} stbiw__jpg_encoder;
+
+static int stbiw__jpg_processDU(stbi__write_context *s, const stbiw__jpg_encoder *e, int *bitBuf, int *bitCnt, float *CDU, int du_stride, const float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+   int i, diff, end0pos;
+   int DU[64];
+
+   e->fdct_kernel(DU, CDU, du_stride, fdtbl);
 
    // Encode DC
    diff = DU[0] - DC;
@@ -1395,6 +1892,135 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
+// encodes the MCU rows covering image rows [y0,y1), starting with fresh dc
+// predictions and ending on a byte boundary, like a scan or restart interval
+static void stbiw__jpg_encode_rows(stbi__write_context *s, const stbiw__jpg_encoder *e, int y0, int y1) {
+   static const unsigned short fillBits[] = {0x7F, 7};
+   int DCY=0, DCU=0, DCV=0;
+   int bitBuf=0, bitCnt=0;
+   int width = e->width, height = e->height, comp = e->comp;
+   const unsigned char *data = e->data;
+   int x, y, row, col, pos;
+   if(e->subsample) {
+      for(y = y0; y < y1; y += 16) {
+         for(x = 0; x < width; x += 16) {
+            float Y[256], U[256], V[256];
+            for(row = y, pos = 0; row < y+16; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               if(x+16 <= width) {
+                  e->RGB_to_YCbCr_kernel(Y+pos, U+pos, V+pos, data + base_p + x*comp, comp, 16);
+                  pos += 16;
+                  continue;
+               }
+               for(col = x; col < x+16; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  stbiw__jpg_RGB_to_YCbCr_row(Y+pos, U+pos, V+pos, data + p, comp, 1);
+               }
+            }
+            DCY = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, Y+0,   16, e->fdtbl_Y, DCY, e->YDC_HT, e->YAC_HT);
+            DCY = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, Y+8,   16, e->fdtbl_Y, DCY, e->YDC_HT, e->YAC_HT);
+            DCY = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, Y+128, 16, e->fdtbl_Y, DCY, e->YDC_HT, e->YAC_HT);
+            DCY = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, Y+136, 16, e->fdtbl_Y, DCY, e->YDC_HT, e->YAC_HT);
+
+            // subsample U,V
+            {
+               float subU[64], subV[64];
+               int yy, xx;
+               for(yy = 0, pos = 0; yy < 8; ++yy) {
+                  for(xx = 0; xx < 8; ++xx, ++pos) {
+                     int j = yy*32+xx*2;
+                     subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
+                     subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
+                  }
+               }
+               DCU = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, subU, 8, e->fdtbl_UV, DCU, e->UVDC_HT, e->UVAC_HT);
+               DCV = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, subV, 8, e->fdtbl_UV, DCV, e->UVDC_HT, e->UVAC_HT);
+            }
+         }
+      }
+   } else {
+      for(y = y0; y < y1; y += 8) {
+         for(x = 0; x < width; x += 8) {
+            float Y[64], U[64], V[64];
+            for(row = y, pos = 0; row < y+8; ++row) {
+               // row >= height => use last input row
+               int clamped_row = (row < height) ? row : height - 1;
+               int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
+               if(x+8 <= width) {
+                  e->RGB_to_YCbCr_kernel(Y+pos, U+pos, V+pos, data + base_p + x*comp, comp, 8);
+                  pos += 8;
+                  continue;
+               }
+               for(col = x; col < x+8; ++col, ++pos) {
+                  // if col >= width => use pixel from last input column
+                  int p = base_p + ((col < width) ? col : (width-1))*comp;
+                  stbiw__jpg_RGB_to_YCbCr_row(Y+pos, U+pos, V+pos, data + p, comp, 1);
+               }
+            }
+
+            DCY = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, Y, 8, e->fdtbl_Y,  DCY, e->YDC_HT, e->YAC_HT);
+            DCU = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, U, 8, e->fdtbl_UV, DCU, e->UVDC_HT, e->UVAC_HT);
+            DCV = stbiw__jpg_processDU(s, e, &bitBuf, &bitCnt, V, 8, e->fdtbl_UV, DCV, e->UVDC_HT, e->UVAC_HT);
+         }
+      }
+   }
+
+   // Do the bit alignment of the EOI or RST marker
+   stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+}
+
+// stripes are encoded into memory first, and only written out once all of
+// them are done. at least a few thousand MCUs each keeps the restart markers'
+// overhead negligible
+#define STBIW__JPG_STRIPE_MCUS 4096
+
+typedef struct
+{
+   unsigned char *data;
+   int size, capacity, failed;
+} stbiw__jpg_buffer;
+
+static void stbiw__jpg_buffer_write(void *context, void *data, int size)
+{
+   stbiw__jpg_buffer *b = (stbiw__jpg_buffer *) context;
+   if (b->failed) return;
+   if (b->size + size > b->capacity) {
+      int capacity = b->capacity ? b->capacity*2 : 4096;
+      unsigned char *p;
+      while (capacity < b->size + size) capacity *= 2;
+      p = (unsigned char *) STBIW_REALLOC_SIZED(b->data, b->capacity, capacity);
+      if (!p) {
+         b->failed = 1;
+         return;
+      }
+      b->data = p;
+      b->capacity = capacity;
+   }
+   STBIW_MEMMOVE(b->data + b->size, data, size);
+   b->size += size;
+}
+
+typedef struct
+{
+   const stbiw__jpg_encoder *e;
+   int stripe_height;
+   stbiw__jpg_buffer *stripes;
+} stbiw__jpg_stripe_job;
+
+static void stbiw__jpg_stripe_task(void *task_data, int i)
+{
+   stbiw__jpg_stripe_job *job = (stbiw__jpg_stripe_job *) task_data;
+   stbi__write_context s = { 0 };
+   int y0 = i * job->stripe_height;
+   int y1 = y0 + job->stripe_height;
+   if (y1 > job->e->height) y1 = job->e->height;
+   stbi__start_write_callbacks(&s, stbiw__jpg_buffer_write, &job->stripes[i]);
+   stbiw__jpg_encode_rows(&s, job->e, y0, y1);
+}
+
 static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
@@ -1467,9 +2093,10 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
    static const float aasf[] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f, 1.175875602f * 2.828427125f,
                                  1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
-   int row, col, i, k, subsample;
+   int row, col, i, k, subsample, mcu_size, mcus_x, mcus_y, stripe_mcus, num_stripes;
    float fdtbl_Y[64], fdtbl_UV[64];
    unsigned char YTable[64], UVTable[64];
+   stbiw__jpg_encoder e;
 
    if(!data || !width || !height || comp > 4 || comp < 1) {
       return 0;
@@ -1494,6 +2121,42 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       }
    }
 
+   e.data = (const unsigned char *) data;
+   e.width = width;
+   e.height = height;
+   e.comp = comp;
+   e.subsample = subsample;
+   e.fdtbl_Y = fdtbl_Y;
+   e.fdtbl_UV = fdtbl_UV;
+   e.YDC_HT = YDC_HT;
+   e.UVDC_HT = UVDC_HT;
+   e.YAC_HT = YAC_HT;
+   e.UVAC_HT = UVAC_HT;
+   e.fdct_kernel = stbiw__jpg_fdct;
+   e.RGB_to_YCbCr_kernel = stbiw__jpg_RGB_to_YCbCr_row;
+#ifdef STBIW_SSE2
+   e.fdct_kernel = stbiw__jpg_fdct_sse2;
+   e.RGB_to_YCbCr_kernel = stbiw__jpg_RGB_to_YCbCr_sse2;
+#endif
+#ifdef STBIW_AVX2
+   if (stbiw__avx2_available()) {
+      e.fdct_kernel = stbiw__jpg_fdct_avx2;
+      e.RGB_to_YCbCr_kernel = stbiw__jpg_RGB_to_YCbCr_avx2;
+   }
+#endif
+
+   // Split into stripes of whole MCU rows. the restart interval is counted in
+   // MCUs and only has 16 bits, so very wide images are written serially
+   mcu_size = subsample ? 16 : 8;
+   mcus_x = (width + mcu_size-1) / mcu_size;
+   mcus_y = (height + mcu_size-1) / mcu_size;
+   stripe_mcus = STBIW__JPG_STRIPE_MCUS / mcus_x;
+   stripe_mcus = stripe_mcus < 1 ? 1 : stripe_mcus;
+   num_stripes = (mcus_y + stripe_mcus-1) / stripe_mcus;
+   if (!stbiw__parallel_for_func || mcus_x * stripe_mcus > 65535) {
+      num_stripes = 1;
+   }
+
    // Write Headers
    {
       static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
@@ -1516,85 +2179,39 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       stbiw__putc(s, 0x11); // HTUACinfo
       s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
       s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      if (num_stripes > 1) {
+         int interval = mcus_x * stripe_mcus;
+         const unsigned char dri[] = { 0xFF,0xDD,0,4,(unsigned char)(interval>>8),STBIW_UCHAR(interval) };
+         s->func(s->context, (void*)dri, sizeof(dri));
+      }
       s->func(s->context, (void*)head2, sizeof(head2));
    }
 
    // Encode 8x8 macroblocks
-   {
-      static const unsigned short fillBits[] = {0x7F, 7};
-      int DCY=0, DCU=0, DCV=0;
-      int bitBuf=0, bitCnt=0;
-      // comp == 2 is grey+alpha (alpha is ignored)
-      int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
-      const unsigned char *dataR = (const unsigned char *)data;
-      const unsigned char *dataG = dataR + ofsG;
-      const unsigned char *dataB = dataR + ofsB;
-      int x, y, pos;
-      if(subsample) {
-         for(y = 0; y < height; y += 16) {
-            for(x = 0; x < width; x += 16) {
-               float Y[256], U[256], V[256];
-               for(row = y, pos = 0; row < y+16; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+16; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-
-               // subsample U,V
-               {
-                  float subU[64], subV[64];
-                  int yy, xx;
-                  for(yy = 0, pos = 0; yy < 8; ++yy) {
-                     for(xx = 0; xx < 8; ++xx, ++pos) {
-                        int j = yy*32+xx*2;
-                        subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
-                        subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
-                     }
-                  }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-               }
-            }
-         }
-      } else {
-         for(y = 0; y < height; y += 8) {
-            for(x = 0; x < width; x += 8) {
-               float Y[64], U[64], V[64];
-               for(row = y, pos = 0; row < y+8; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+8; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+   if(num_stripes > 1) {
+      stbiw__jpg_stripe_job job;
+      int ok = 1;
+      job.e = &e;
+      job.stripe_height = stripe_mcus * mcu_size;
+      job.stripes = (stbiw__jpg_buffer *) STBIW_MALLOC(num_stripes * sizeof(stbiw__jpg_buffer));
+      if (!job.stripes) return 0;
+      memset(job.stripes, 0, num_stripes * sizeof(stbiw__jpg_buffer));
+      stbiw__parallel_for_func(stbiw__parallel_for_user, stbiw__jpg_stripe_task, &job, num_stripes);
+      for(i = 0; i < num_stripes; ++i) {
+         ok = ok && !job.stripes[i].failed;
+         if (ok) {
+            s->func(s->context, job.stripes[i].data, job.stripes[i].size);
+            if (i < num_stripes-1) {
+               stbiw__putc(s, 0xFF);
+               stbiw__putc(s, (unsigned char) (0xD0 + (i & 7))); // RSTn
             }
          }
+         STBIW_FREE(job.stripes[i].data);
       }
-
-      // Do the bit alignment of the EOI marker
-      stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      STBIW_FREE(job.stripes);
+      if (!ok) return 0;
+   } else {
+      stbiw__jpg_encode_rows(s, &e, 0, height);
    }
 
    // EOI
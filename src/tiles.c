@@ -0,0 +1,121 @@
+#include "tiles.h"
+
+#include "shader.h"
+
+#include <assert.h>
+
+// Distance between the starts of neighboring tiles, leaving room for a border
+// on both sides
+#define TILE_STRIDE (TILE_SIZE - 2 * TILE_BORDER)
+
+static int tiles_for_size(int size) {
+    if (size <= TILE_SIZE) {
+        return 1;
+    }
+    // The first and last tiles only have a border on one side
+    return (size - TILE_BORDER + TILE_STRIDE - 1) / TILE_STRIDE;
+}
+
+// Gets the range of tile i of n along an axis of the image
+static void get_tile_span(int i, int n, int size, int* content_start,
+                          int* content_end, int* stored_start,
+                          int* stored_end) {
+    *content_start = i * TILE_STRIDE;
+    *content_end = i == n - 1 ? size : *content_start + TILE_STRIDE;
+    *stored_start = i == 0 ? 0 : *content_start - TILE_BORDER;
+    *stored_end = i == n - 1 ? size : *content_end + TILE_BORDER;
+    assert(*stored_end - *stored_start <= TILE_SIZE);
+}
+
+void tile_grid_init(TileGrid* grid) {
+    grid->w = 0;
+    grid->h = 0;
+    grid->cols = 0;
+    grid->rows = 0;
+    grid->fmt = GL_RGBA;
+    grid->tex = NULL;
+}
+
+void tile_grid_deinit(TileGrid* grid) {
+    if (grid->tex) {
+        GLDEBUG(glDeleteTextures(tile_grid_count(grid), grid->tex));
+        free(grid->tex);
+    }
+    tile_grid_init(grid);
+}
+
+bool tile_grid_alloc(TileGrid* grid, int w, int h, GLint fmt) {
+    tile_grid_deinit(grid);
+
+    const int cols = tiles_for_size(w);
+    const int rows = tiles_for_size(h);
+    grid->tex = malloc(sizeof(GLuint) * cols * rows);
+    if (grid->tex == NULL) {
+        FATAL_ERROR("failed to allocate %d tiles\n", cols * rows);
+        return false;
+    }
+    grid->w = w;
+    grid->h = h;
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->fmt = fmt;
+
+    GLDEBUG(glGenTextures(cols * rows, grid->tex));
+    for (int i = 0; i < cols * rows; ++i) {
+        TileRect content, stored;
+        tile_grid_get_rects(grid, i, &content, &stored);
+        GLDEBUG(glBindTexture(GL_TEXTURE_2D, grid->tex[i]));
+        gl_debug_label(GL_TEXTURE, grid->tex[i], "tile");
+        GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                                GL_LINEAR));
+        GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                                GL_LINEAR));
+        // Wrapping around would blend in the far side of the tile, which isn't
+        // the far side of the image anymore
+        GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+                                GL_CLAMP_TO_EDGE));
+        GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+                                GL_CLAMP_TO_EDGE));
+        // Core profiles have no luminance textures, grey images are stored in
+        // the red channel, with alpha in green, and sampled as grey
+        if (fmt == GL_RED) {
+            const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+            GLDEBUG(glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                                     swizzle));
+        } else if (fmt == GL_RG) {
+            const GLint swizzle[4] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+            GLDEBUG(glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                                     swizzle));
+        }
+        GLDEBUG(glTexImage2D(GL_TEXTURE_2D, 0, fmt, stored.w, stored.h, 0, fmt,
+                             GL_UNSIGNED_BYTE, NULL));
+    }
+    return true;
+}
+
+void tile_grid_generate_mipmaps(const TileGrid* grid) {
+    for (int i = 0; i < tile_grid_count(grid); ++i) {
+        GLDEBUG(glBindTexture(GL_TEXTURE_2D, grid->tex[i]));
+        GLDEBUG(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                                GL_LINEAR_MIPMAP_LINEAR));
+        GLDEBUG(glGenerateMipmap(GL_TEXTURE_2D));
+    }
+}
+
+void tile_grid_get_rects(const TileGrid* grid, int i, TileRect* content,
+                         TileRect* stored) {
+    const int col = i % grid->cols;
+    const int row = i / grid->cols;
+    int x0, x1, y0, y1, sx0, sx1, sy0, sy1;
+    get_tile_span(col, grid->cols, grid->w, &x0, &x1, &sx0, &sx1);
+    get_tile_span(row, grid->rows, grid->h, &y0, &y1, &sy0, &sy1);
+
+    content->x = x0;
+    content->y = y0;
+    content->w = x1 - x0;
+    content->h = y1 - y0;
+    stored->x = sx0;
+    stored->y = sy0;
+    stored->w = sx1 - sx0;
+    stored->h = sy1 - sy0;
+}
@@ -0,0 +1,51 @@
+#ifndef IVAC_SRC_TILES_H_P7LQ2ZVD
+#define IVAC_SRC_TILES_H_P7LQ2ZVD
+
+#include "gl_core_4_3.h"
+
+#include <stdbool.h>
+
+// Largest width or height of a tile's texture. Well below the 16384
+// GL_MAX_TEXTURE_SIZE that GL 4.3 guarantees.
+#define TILE_SIZE 2048
+// Pixels each tile shares with its neighbors, so filtering can sample across
+// tile edges without seams. Enough for the first few mipmap levels too.
+#define TILE_BORDER 8
+
+typedef struct tile_rect {
+    int x, y, w, h;
+} TileRect;
+
+// An image split over a grid of textures, so its size isn't limited by
+// GL_MAX_TEXTURE_SIZE. Each tile is drawn for its own part of the image, but
+// its texture also holds a border of the neighboring tiles' pixels. Images no
+// bigger than TILE_SIZE are a single texture with no border.
+typedef struct tile_grid {
+    // Size of the whole image
+    int w, h;
+    int cols, rows;
+    GLint fmt;
+    // cols * rows textures, row by row starting from the image's first row
+    GLuint* tex;
+} TileGrid;
+
+void tile_grid_init(TileGrid* grid);
+void tile_grid_deinit(TileGrid* grid);
+
+// Replaces the tiles with empty ones for a w x h image
+bool tile_grid_alloc(TileGrid* grid, int w, int h, GLint fmt);
+
+static inline int tile_grid_count(const TileGrid* grid) {
+    return grid->cols * grid->rows;
+}
+
+// Builds the mip chain of every tile from its first level and samples them
+// trilinearly from then on
+void tile_grid_generate_mipmaps(const TileGrid* grid);
+
+// Gets the part of the image tile i is drawn for, and the part stored in its
+// texture, which also includes the border
+void tile_grid_get_rects(const TileGrid* grid, int i, TileRect* content,
+                         TileRect* stored);
+
+#endif /* IVAC_SRC_TILES_H_P7LQ2ZVD */
@@ -0,0 +1,103 @@
+#include "timers.h"
+
+#include "shader.h"
+
+#include <assert.h>
+#include <time.h>
+
+// Driver workaround: llvmpipe answers the first GL_TIME_ELAPSED query of a
+// context that hasn't rendered anything yet with the GPU's timestamp instead
+// of the time elapsed, even though it was begun and ended like any other and
+// its result is available. Results longer than this, 10 seconds, can only be
+// such timestamps, as nothing timed comes close to a frame taking that long.
+#define GPU_TIMER_MAX_NS 10000000000ull
+
+void timer_history_init(TimerHistory* history) {
+    history->next = 0;
+    history->count = 0;
+}
+
+void timer_history_add(TimerHistory* history, float ms) {
+    history->ms[history->next] = ms;
+    history->next = (history->next + 1) % TIMER_HISTORY;
+    if (history->count < TIMER_HISTORY) {
+        ++history->count;
+    }
+}
+
+float timer_history_get(const TimerHistory* history, int i) {
+    assert(i < history->count);
+    const int oldest =
+        history->count < TIMER_HISTORY ? 0 : history->next;
+    return history->ms[(oldest + i) % TIMER_HISTORY];
+}
+
+float timer_history_average(const TimerHistory* history) {
+    if (history->count == 0) {
+        return 0;
+    }
+    float sum = 0;
+    for (int i = 0; i < history->count; ++i) {
+        sum += history->ms[i];
+    }
+    return sum / history->count;
+}
+
+void gpu_timer_init(GpuTimer* timer) {
+    GLDEBUG(glGenQueries(GPU_TIMER_QUERIES, timer->queries));
+    timer->next = 0;
+    timer->oldest = 0;
+    timer->num_pending = 0;
+    timer->running = false;
+    timer_history_init(&timer->history);
+}
+
+void gpu_timer_deinit(GpuTimer* timer) {
+    GLDEBUG(glDeleteQueries(GPU_TIMER_QUERIES, timer->queries));
+}
+
+void gpu_timer_begin(GpuTimer* timer) {
+    gpu_timer_poll(timer);
+    if (timer->num_pending == GPU_TIMER_QUERIES) {
+        return;
+    }
+    GLDEBUG(glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->next]));
+    timer->running = true;
+}
+
+void gpu_timer_end(GpuTimer* timer) {
+    if (!timer->running) {
+        return;
+    }
+    GLDEBUG(glEndQuery(GL_TIME_ELAPSED));
+    timer->running = false;
+    timer->next = (timer->next + 1) % GPU_TIMER_QUERIES;
+    ++timer->num_pending;
+}
+
+void gpu_timer_poll(GpuTimer* timer) {
+    // Queries finish in the order they were issued
+    while (timer->num_pending > 0) {
+        const GLuint query = timer->queries[timer->oldest];
+        GLint available;
+        GLDEBUG(glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE,
+                                   &available));
+        if (!available) {
+            break;
+        }
+        GLuint64 ns;
+        GLDEBUG(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns));
+        // Drop the bogus results described at GPU_TIMER_MAX_NS
+        if (ns < GPU_TIMER_MAX_NS) {
+            timer_history_add(&timer->history, ns * 1e-6f);
+        }
+        timer->oldest = (timer->oldest + 1) % GPU_TIMER_QUERIES;
+        --timer->num_pending;
+    }
+}
+
+double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
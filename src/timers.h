@@ -0,0 +1,52 @@
+#ifndef IVAC_SRC_TIMERS_H_H6VZ2WPN
+#define IVAC_SRC_TIMERS_H_H6VZ2WPN
+
+#include "gl_core_4_3.h"
+
+#include <stdbool.h>
+
+// Samples kept by each timer, the width of its graph on the HUD
+#define TIMER_HISTORY 120
+// Queries cycled through by each GPU timer. Results are only read once the
+// GPU has finished with them a frame or two later, so timing never stalls.
+#define GPU_TIMER_QUERIES 3
+
+// The most recent samples of something timed, in milliseconds
+typedef struct timer_history {
+    float ms[TIMER_HISTORY];
+    // Where the next sample goes, the oldest sample once the history is full
+    int next;
+    int count;
+} TimerHistory;
+
+void timer_history_init(TimerHistory* history);
+void timer_history_add(TimerHistory* history, float ms);
+// Gets sample i, counting from the oldest
+float timer_history_get(const TimerHistory* history, int i);
+float timer_history_average(const TimerHistory* history);
+
+// Times GL commands on the GPU with GL_TIME_ELAPSED queries
+typedef struct gpu_timer {
+    GLuint queries[GPU_TIMER_QUERIES];
+    // Next query to start, and the oldest one still waiting for a result
+    int next;
+    int oldest;
+    int num_pending;
+    // Set between begin and end, unless every query was still in flight
+    bool running;
+    TimerHistory history;
+} GpuTimer;
+
+void gpu_timer_init(GpuTimer* timer);
+void gpu_timer_deinit(GpuTimer* timer);
+// Only one timer can be running at a time. Nothing is measured if all of its
+// queries are still waiting for results.
+void gpu_timer_begin(GpuTimer* timer);
+void gpu_timer_end(GpuTimer* timer);
+// Adds the results that have arrived to the history, without waiting
+void gpu_timer_poll(GpuTimer* timer);
+
+// A monotonic CPU clock in milliseconds
+double get_time_ms(void);
+
+#endif /* IVAC_SRC_TIMERS_H_H6VZ2WPN */
@@ -0,0 +1,229 @@
+#include "trace.h"
+
+#include "shader.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct trace_event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+};
+
+// The zones of one thread. Only the owning thread writes to it, so recording
+// a zone never takes a lock or waits on another thread.
+typedef struct trace_buffer {
+    // Thread id shown in the trace, in the order threads started tracing
+    int tid;
+    const char* name;
+    // Zones begun but not ended yet, innermost last
+    const char* open_names[TRACE_MAX_DEPTH];
+    uint64_t open_starts[TRACE_MAX_DEPTH];
+    // Can go past TRACE_MAX_DEPTH, so the ends still match up
+    int depth;
+    // Zones ended so far, including overwritten ones. Stored with release
+    // order after the event is written, so the reader only sees whole events.
+    atomic_size_t count;
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+    struct trace_buffer* next;
+} TraceBuffer;
+
+atomic_bool trace_enabled = false;
+
+static FILE* trace_file;
+static const char* trace_path;
+// Zones are written relative to this, in nanoseconds
+static uint64_t trace_start_ns;
+// Every thread's buffer, most recently started first. Threads push their own
+// buffer with a compare and swap the first time they trace.
+static _Atomic(TraceBuffer*) trace_buffers;
+static atomic_int next_tid;
+// Bumped by trace_shutdown, which frees every thread's buffer but can't clear
+// the other threads' pointers to them. They tell theirs is stale by the
+// generation it was allocated in.
+static atomic_uint trace_generation;
+
+static _Thread_local TraceBuffer* thread_buffer;
+static _Thread_local unsigned thread_generation;
+// Set if the calling thread's buffer couldn't be allocated, so it isn't
+// retried for every zone
+static _Thread_local bool thread_buffer_failed;
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The calling thread's buffer, or NULL if it hasn't got one since tracing
+// last started
+static TraceBuffer* current_thread_buffer(void) {
+    const unsigned generation =
+        atomic_load_explicit(&trace_generation, memory_order_relaxed);
+    if (thread_generation != generation) {
+        thread_buffer = NULL;
+        thread_buffer_failed = false;
+        thread_generation = generation;
+    }
+    return thread_buffer;
+}
+
+static TraceBuffer* get_thread_buffer(void) {
+    if (current_thread_buffer() != NULL || thread_buffer_failed) {
+        return thread_buffer;
+    }
+    // The events are left untouched, so only the pages a thread actually
+    // records into are ever committed
+    TraceBuffer* const buffer = malloc(sizeof(*buffer));
+    if (buffer == NULL) {
+        FATAL_ERROR("failed to allocate trace buffer\n");
+        thread_buffer_failed = true;
+        return NULL;
+    }
+    buffer->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    buffer->name = NULL;
+    buffer->depth = 0;
+    atomic_init(&buffer->count, 0);
+    buffer->next = atomic_load(&trace_buffers);
+    while (!atomic_compare_exchange_weak(&trace_buffers, &buffer->next,
+                                         buffer)) {
+    }
+    thread_buffer = buffer;
+    return buffer;
+}
+
+bool trace_init(const char* path) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        FATAL_ERROR("failed to open trace file %s\n", path);
+        return false;
+    }
+    trace_path = path;
+    trace_start_ns = get_time_ns();
+    atomic_store(&trace_enabled, true);
+    return true;
+}
+
+void trace_thread_name(const char* name) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    TraceBuffer* const buffer = get_thread_buffer();
+    if (buffer) {
+        buffer->name = name;
+    }
+}
+
+void trace_begin(const char* name) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    TraceBuffer* const buffer = get_thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    if (buffer->depth < TRACE_MAX_DEPTH) {
+        buffer->open_names[buffer->depth] = name;
+        buffer->open_starts[buffer->depth] = get_time_ns();
+    }
+    ++buffer->depth;
+}
+
+void trace_end(void) {
+    const uint64_t end = get_time_ns();
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    TraceBuffer* const buffer = current_thread_buffer();
+    // Tracing may have started in the middle of the zone
+    if (buffer == NULL || buffer->depth == 0) {
+        return;
+    }
+    const int depth = --buffer->depth;
+    if (depth >= TRACE_MAX_DEPTH) {
+        return;
+    }
+    const size_t count =
+        atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    struct trace_event* const event =
+        &buffer->events[count % TRACE_BUFFER_EVENTS];
+    event->name = buffer->open_names[depth];
+    event->start_ns = buffer->open_starts[depth];
+    event->duration_ns = end - event->start_ns;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+// Writes s as a JSON string
+static void write_string(FILE* file, const char* s) {
+    fputc('"', file);
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+void trace_shutdown(void) {
+    if (!atomic_exchange(&trace_enabled, false)) {
+        return;
+    }
+
+    // Chrome's trace event format, with timestamps and durations in
+    // microseconds
+    FILE* const file = trace_file;
+    fprintf(file, "{\"traceEvents\":[\n");
+    const char* separator = "";
+    size_t num_written = 0;
+    size_t num_dropped = 0;
+    TraceBuffer* buffer = atomic_exchange(&trace_buffers, NULL);
+    atomic_fetch_add(&trace_generation, 1);
+    while (buffer) {
+        if (buffer->name) {
+            fprintf(file,
+                    "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":%d,\"args\":{\"name\":",
+                    separator, buffer->tid);
+            write_string(file, buffer->name);
+            fprintf(file, "}}");
+            separator = ",\n";
+        }
+        const size_t count =
+            atomic_load_explicit(&buffer->count, memory_order_acquire);
+        const size_t first =
+            count > TRACE_BUFFER_EVENTS ? count - TRACE_BUFFER_EVENTS : 0;
+        for (size_t i = first; i < count; ++i) {
+            const struct trace_event* const event =
+                &buffer->events[i % TRACE_BUFFER_EVENTS];
+            fprintf(file, "%s{\"name\":", separator);
+            write_string(file, event->name);
+            fprintf(file,
+                    ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,"
+                    "\"tid\":%d}",
+                    (event->start_ns - trace_start_ns) * 1e-3,
+                    event->duration_ns * 1e-3, buffer->tid);
+            separator = ",\n";
+        }
+        num_written += count - first;
+        num_dropped += first;
+
+        TraceBuffer* const next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fclose(file) != 0) {
+        FATAL_ERROR("failed to write trace file %s\n", trace_path);
+        return;
+    }
+    printf("Wrote %zu trace events to %s", num_written, trace_path);
+    if (num_dropped > 0) {
+        printf(", %zu older ones were overwritten", num_dropped);
+    }
+    printf("\n");
+}
@@ -0,0 +1,48 @@
+#ifndef IVAC_SRC_TRACE_H_K8TD3VQM
+#define IVAC_SRC_TRACE_H_K8TD3VQM
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Zones a thread can be inside of at once. Deeper zones aren't recorded.
+#define TRACE_MAX_DEPTH 32
+// Finished zones kept per thread. Once a thread's buffer is full its oldest
+// zones are overwritten.
+#define TRACE_BUFFER_EVENTS (1 << 16)
+
+// Set while tracing, read with TRACE_BEGIN and TRACE_END
+extern atomic_bool trace_enabled;
+
+// Starts recording zones, to be written to path as a Chrome trace event file
+// that chrome://tracing and Perfetto can open. Call before starting any
+// threads that trace.
+bool trace_init(const char* path);
+// Stops recording and writes the file. Threads that traced should have
+// stopped by now, their zones are kept after they exit. Any trace call made
+// after it returns does nothing, on any thread. Does nothing if tracing
+// wasn't started.
+void trace_shutdown(void);
+
+// Names the calling thread in the trace. name has to stay valid until
+// trace_shutdown.
+void trace_thread_name(const char* name);
+// Records a zone from now until the matching trace_end on the same thread.
+// name has to stay valid until trace_shutdown.
+void trace_begin(const char* name);
+void trace_end(void);
+
+// Only cost a relaxed load and a branch while tracing is off
+#define TRACE_BEGIN(name)                                                  \
+    do {                                                                   \
+        if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {  \
+            trace_begin(name);                                             \
+        }                                                                  \
+    } while (0)
+#define TRACE_END()                                                        \
+    do {                                                                   \
+        if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {  \
+            trace_end();                                                   \
+        }                                                                  \
+    } while (0)
+
+#endif /* IVAC_SRC_TRACE_H_K8TD3VQM */
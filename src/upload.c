@@ -0,0 +1,176 @@
+#include "upload.h"
+
+#include "shader.h"
+#include "trace.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// Roughly how much is copied per stripe
+#define UPLOAD_STRIPE_BYTES (4 << 20)
+// How long to wait for a buffer when all of them are busy, in nanoseconds
+#define UPLOAD_WAIT_NS 1000000
+
+void texture_upload_init(TextureUpload* upload) {
+    GLDEBUG(glGenBuffers(UPLOAD_NUM_BUFFERS, upload->pbos));
+    for (int i = 0; i < UPLOAD_NUM_BUFFERS; ++i) {
+        upload->fences[i] = NULL;
+    }
+    upload->buffer_size = 0;
+    upload->next_buffer = 0;
+    upload->image = NULL;
+}
+
+void texture_upload_deinit(TextureUpload* upload) {
+    for (int i = 0; i < UPLOAD_NUM_BUFFERS; ++i) {
+        if (upload->fences[i]) {
+            GLDEBUG(glDeleteSync(upload->fences[i]));
+        }
+    }
+    GLDEBUG(glDeleteBuffers(UPLOAD_NUM_BUFFERS, upload->pbos));
+}
+
+bool texture_upload_start(TextureUpload* upload, TileGrid* tiles, GLint fmt,
+                          const Image* image) {
+    if (!tile_grid_alloc(tiles, image->w, image->h, fmt)) {
+        return false;
+    }
+
+    const size_t row_size = (size_t)image->w * image->c;
+    int stripe_rows = UPLOAD_STRIPE_BYTES / row_size;
+    if (stripe_rows < 1) {
+        stripe_rows = 1;
+    } else if (stripe_rows > image->h) {
+        stripe_rows = image->h;
+    }
+    upload->tiles = tiles;
+    upload->image = image;
+    upload->stripe_rows = stripe_rows;
+    upload->next_row = 0;
+
+    // Only reallocate the buffers if the stripes don't fit anymore. Orphaning
+    // them with glBufferData is fine even if they're still in use.
+    const size_t buffer_size = stripe_rows * row_size;
+    if (buffer_size > upload->buffer_size) {
+        for (int i = 0; i < UPLOAD_NUM_BUFFERS; ++i) {
+            GLDEBUG(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pbos[i]));
+            GLDEBUG(glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL,
+                                 GL_STREAM_DRAW));
+            // Only named once they exist, which is on first bind
+            if (upload->buffer_size == 0) {
+                gl_debug_label(GL_BUFFER, upload->pbos[i], "upload buffer");
+            }
+        }
+        GLDEBUG(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+        upload->buffer_size = buffer_size;
+    }
+    return true;
+}
+
+// Returns true if the GPU is done with the buffer, waiting up to timeout
+// nanoseconds for it
+static bool wait_for_buffer(TextureUpload* upload, int buffer,
+                            GLuint64 timeout) {
+    GLsync fence = upload->fences[buffer];
+    if (fence == NULL) {
+        return true;
+    }
+    const GLenum status =
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+    if (status == GL_WAIT_FAILED) {
+        FATAL_ERROR("glClientWaitSync failed\n");
+    }
+    GLDEBUG(glDeleteSync(fence));
+    upload->fences[buffer] = NULL;
+    return true;
+}
+
+// Copies rows [first_row, first_row + rows) of the image into every tile they
+// overlap. pixels is the address of first_row, either in client memory or as
+// an offset into the bound pixel buffer.
+static void upload_rows(const TileGrid* tiles, int c, int first_row, int rows,
+                        uintptr_t pixels) {
+    const int end_row = first_row + rows;
+    for (int i = 0; i < tile_grid_count(tiles); ++i) {
+        TileRect content, stored;
+        tile_grid_get_rects(tiles, i, &content, &stored);
+        const int y0 = first_row > stored.y ? first_row : stored.y;
+        const int y1 = end_row < stored.y + stored.h ? end_row
+                                                     : stored.y + stored.h;
+        if (y0 >= y1) {
+            continue;
+        }
+        const size_t offset =
+            ((size_t)(y0 - first_row) * tiles->w + stored.x) * c;
+        GLDEBUG(glBindTexture(GL_TEXTURE_2D, tiles->tex[i]));
+        GLDEBUG(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0 - stored.y, stored.w,
+                                y1 - y0, tiles->fmt, GL_UNSIGNED_BYTE,
+                                (const void*)(pixels + offset)));
+    }
+}
+
+bool texture_upload_step(TextureUpload* upload) {
+    const Image* const image = upload->image;
+    if (image == NULL) {
+        return true;
+    }
+    const size_t row_size = (size_t)image->w * image->c;
+    TRACE_BEGIN("upload step");
+
+    // Rows are tightly packed, and tiles only take part of each row
+    GLDEBUG(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GLDEBUG(glPixelStorei(GL_UNPACK_ROW_LENGTH, image->w));
+    for (int i = 0; i < UPLOAD_NUM_BUFFERS && upload->next_row < image->h;
+         ++i) {
+        const int buffer = upload->next_buffer;
+        if (!wait_for_buffer(upload, buffer, i == 0 ? UPLOAD_WAIT_NS : 0)) {
+            break;
+        }
+
+        int rows = image->h - upload->next_row;
+        if (rows > upload->stripe_rows) {
+            rows = upload->stripe_rows;
+        }
+        const size_t size = rows * row_size;
+
+        const uint8_t* const src = image->data + upload->next_row * row_size;
+
+        // The fence already guarantees the GPU is done with this buffer, so
+        // the driver doesn't need to synchronize the mapping
+        GLDEBUG(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->pbos[buffer]));
+        void* const dst = glMapBufferRange(
+            GL_PIXEL_UNPACK_BUFFER, 0, size,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                GL_MAP_UNSYNCHRONIZED_BIT);
+        if (dst != NULL) {
+            memcpy(dst, src, size);
+            GLDEBUG(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+            upload_rows(upload->tiles, image->c, upload->next_row, rows, 0);
+        } else {
+            // Still works without the buffer, just with a synchronous copy
+            FATAL_ERROR("failed to map pixel buffer\n");
+            GLDEBUG(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+            upload_rows(upload->tiles, image->c, upload->next_row, rows,
+                        (uintptr_t)src);
+        }
+        upload->fences[buffer] =
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        upload->next_row += rows;
+        upload->next_buffer = (buffer + 1) % UPLOAD_NUM_BUFFERS;
+    }
+    GLDEBUG(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    GLDEBUG(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    GLDEBUG(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+    TRACE_END();
+
+    if (upload->next_row < image->h) {
+        return false;
+    }
+    upload->image = NULL;
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef IVAC_SRC_UPLOAD_H_KHH5XCJ9
+#define IVAC_SRC_UPLOAD_H_KHH5XCJ9
+
+#include "gl_core_4_3.h"
+#include "loader.h"
+#include "tiles.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of pixel buffers cycled through, so one can be filled while the GPU
+// is still copying out of the others
+#define UPLOAD_NUM_BUFFERS 3
+
+// Streams an image into a grid of tiles through a ring of pixel buffer objects,
+// a horizontal stripe at a time, so a big image is uploaded over several
+// frames instead of stalling the window in one glTexImage2D call.
+typedef struct texture_upload {
+    GLuint pbos[UPLOAD_NUM_BUFFERS];
+    // Set once the texture has been read out of the matching buffer
+    GLsync fences[UPLOAD_NUM_BUFFERS];
+    size_t buffer_size;
+    int next_buffer;
+
+    // Tiles and image of the upload in progress
+    TileGrid* tiles;
+    const Image* image;
+    int stripe_rows;
+    // First row that hasn't been uploaded yet
+    int next_row;
+} TextureUpload;
+
+void texture_upload_init(TextureUpload* upload);
+void texture_upload_deinit(TextureUpload* upload);
+
+// Allocates tiles to fit image and starts streaming image into them. image
+// has to stay valid until texture_upload_step returns true.
+bool texture_upload_start(TextureUpload* upload, TileGrid* tiles, GLint fmt,
+                          const Image* image);
+// Uploads as many stripes as there are free buffers, waiting briefly for one
+// if there are none. Returns true once the whole image has been sent.
+bool texture_upload_step(TextureUpload* upload);
+
+#endif /* IVAC_SRC_UPLOAD_H_KHH5XCJ9 */
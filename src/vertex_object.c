@@ -39,6 +39,14 @@ void vertex_object_init(VertexObject* vo, unsigned int num_attribs,
     glBindVertexArray(0);
 }
 
+void vertex_object_set_instanced(VertexObject* vo, unsigned int num_attribs) {
+    glBindVertexArray(vo->vao);
+    for (unsigned int i = 0; i < num_attribs; i++) {
+        glVertexAttribDivisor(i, 1);
+    }
+    glBindVertexArray(0);
+}
+
 void vertex_object_deinit(VertexObject* vo) {
     glDeleteBuffers(1, &vo->vbo);
     glDeleteVertexArrays(1, &vo->vao);
@@ -12,5 +12,9 @@ void vertex_object_init(VertexObject* vo, unsigned int num_attribs,
                         const GLenum* attrib_types,
                         const uint8_t* attrib_counts);
 
+// Makes the first num_attribs attributes advance once per instance instead of
+// once per vertex
+void vertex_object_set_instanced(VertexObject* vo, unsigned int num_attribs);
+
 void vertex_object_deinit(VertexObject* vo);
 #endif /* IVAC_SRC_VAO_H_HJKNW8LT */
@@ -0,0 +1,2 @@
+#define WRITE_JPG write_jpg_default
+#include "jpeg_write_variant.h"
@@ -0,0 +1,3 @@
+#define STBIW_NO_SIMD
+#define WRITE_JPG write_jpg_scalar
+#include "jpeg_write_variant.h"
@@ -0,0 +1,3 @@
+#define STBIW_NO_AVX2
+#define WRITE_JPG write_jpg_sse2
+#include "jpeg_write_variant.h"
@@ -0,0 +1,42 @@
+// Builds a private copy of stb_image_write.h into the including file, with
+// whatever SIMD switches it defined first, and wraps it in a function called
+// WRITE_JPG. Only include it once per file.
+
+#include "jpeg_write_variants.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Most of the static copy goes unused
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+static void append(void* context, void* data, int size) {
+    Encoded* const out = context;
+    if (out->failed) {
+        return;
+    }
+    if (out->size + size > out->capacity) {
+        const size_t capacity = (out->size + size) * 2;
+        uint8_t* const grown = realloc(out->data, capacity);
+        if (grown == NULL) {
+            out->failed = true;
+            return;
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+bool WRITE_JPG(Encoded* out, int w, int h, int c, const uint8_t* pixels,
+               int quality) {
+    return stbi_write_jpg_to_func(append, out, w, h, c, pixels, quality) &&
+           !out->failed;
+}
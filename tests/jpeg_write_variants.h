@@ -0,0 +1,30 @@
+#ifndef IVAC_TESTS_JPEG_WRITE_VARIANTS_H_W7KD2MPA
+#define IVAC_TESTS_JPEG_WRITE_VARIANTS_H_W7KD2MPA
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A JPEG encoded into memory
+typedef struct encoded {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    // Set if the buffer couldn't grow
+    bool failed;
+} Encoded;
+
+// The same stb_image_write.h, each built into its own file with different
+// SIMD kernels. out has to start out empty, and is freed by the caller.
+//
+// Plain C only
+bool write_jpg_scalar(Encoded* out, int w, int h, int c,
+                      const uint8_t* pixels, int quality);
+// SSE2 but no AVX2
+bool write_jpg_sse2(Encoded* out, int w, int h, int c, const uint8_t* pixels,
+                    int quality);
+// Whatever the CPU supports, like ivac itself
+bool write_jpg_default(Encoded* out, int w, int h, int c,
+                       const uint8_t* pixels, int quality);
+
+#endif /* IVAC_TESTS_JPEG_WRITE_VARIANTS_H_W7KD2MPA */
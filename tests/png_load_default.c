@@ -0,0 +1,2 @@
+#define LOAD_PNG load_png_default
+#include "png_load_variant.h"
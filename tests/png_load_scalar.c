@@ -0,0 +1,3 @@
+#define STBI_NO_SIMD
+#define LOAD_PNG load_png_scalar
+#include "png_load_variant.h"
@@ -0,0 +1,23 @@
+// Builds a private copy of stb_image.h's PNG decoder into the including file,
+// with whatever SIMD switches it defined first, and wraps it in a function
+// called LOAD_PNG. Only include it once per file.
+
+#include "png_load_variants.h"
+
+// Most of the static copy goes unused
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#include "stb_image.h"
+
+void* LOAD_PNG(const uint8_t* data, size_t size, int is_16, int* w, int* h,
+               int* c, int req_comp) {
+    if (is_16) {
+        return stbi_load_16_from_memory(data, (int)size, w, h, c, req_comp);
+    }
+    return stbi_load_from_memory(data, (int)size, w, h, c, req_comp);
+}
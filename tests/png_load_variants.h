@@ -0,0 +1,18 @@
+#ifndef IVAC_TESTS_PNG_LOAD_VARIANTS_H_R2XN6FQC
+#define IVAC_TESTS_PNG_LOAD_VARIANTS_H_R2XN6FQC
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The same stb_image.h, each built into its own file with different SIMD
+// kernels. Like stbi_load_from_memory, or stbi_load_16_from_memory if is_16 is
+// set, so each channel takes two bytes. The result is freed with free().
+//
+// Plain C only
+void* load_png_scalar(const uint8_t* data, size_t size, int is_16, int* w,
+                      int* h, int* c, int req_comp);
+// With SSE2 where the CPU has it, like ivac itself
+void* load_png_default(const uint8_t* data, size_t size, int is_16, int* w,
+                       int* h, int* c, int req_comp);
+
+#endif /* IVAC_TESTS_PNG_LOAD_VARIANTS_H_R2XN6FQC */
@@ -0,0 +1,225 @@
+// Checks the CPU contrast adjustment. By default the SIMD paths are compared
+// with the plain C ones, which have to match exactly. With --gpu the 8-bit
+// results are compared with the image shader run on a headless context, which
+// rounds on its own and may differ by 1.
+
+#include "adjust.h"
+#include "headless.h"
+#include "render.h"
+#include "shader.h"
+#include "tiles.h"
+#include "upload.h"
+#include "vertex_object.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ctest's SKIP_RETURN_CODE, for when there's no GL context to compare with
+#define TEST_SKIPPED 77
+
+// Including ones that clamp every value, and 1, which changes nothing
+static const float contrasts[] = {0.0f, 0.3f, 1.0f, 1.7f, 4.0f};
+#define NUM_CONTRASTS (int)(sizeof(contrasts) / sizeof(*contrasts))
+
+// Odd lengths leave a tail after each SIMD path
+static const int lengths[] = {1, 2, 3, 7, 15, 17, 31, 33, 63, 65, 257, 1001};
+#define NUM_LENGTHS (int)(sizeof(lengths) / sizeof(*lengths))
+
+// Image sizes for the GPU, including ones spread over several tiles
+static const int gpu_sizes[][2] = {
+    {1, 1}, {7, 3}, {333, 211}, {TILE_SIZE + 52, 5}, {5, TILE_SIZE + 52},
+};
+#define NUM_GPU_SIZES (int)(sizeof(gpu_sizes) / sizeof(*gpu_sizes))
+
+static uint32_t random_state = 0x9e3779b9u;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static bool check_u8(int c, float contrast, int num_pixels) {
+    const size_t n = (size_t)num_pixels * c;
+    uint8_t* const values = malloc(n);
+    uint8_t* const expected = malloc(n);
+    if (values == NULL || expected == NULL) {
+        FATAL_ERROR("malloc failed\n");
+        free(values);
+        free(expected);
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = next_random();
+    }
+    memcpy(expected, values, n);
+    adjust_contrast(values, num_pixels, c, contrast);
+    adjust_contrast_ref(expected, num_pixels, c, contrast);
+
+    bool ok = true;
+    for (size_t i = 0; i < n && ok; ++i) {
+        if (values[i] != expected[i]) {
+            printf("adjust_contrast c=%d contrast=%g pixels=%d: value %zu is "
+                   "%d, expected %d\n",
+                   c, contrast, num_pixels, i, values[i], expected[i]);
+            ok = false;
+        }
+    }
+    free(values);
+    free(expected);
+    return ok;
+}
+
+static bool check_f32(int c, float contrast, int num_pixels) {
+    const size_t n = (size_t)num_pixels * c;
+    float* const values = malloc(n * sizeof(float));
+    float* const expected = malloc(n * sizeof(float));
+    if (values == NULL || expected == NULL) {
+        FATAL_ERROR("malloc failed\n");
+        free(values);
+        free(expected);
+        return false;
+    }
+    // Float pixels aren't clamped, so go a bit outside 0..1 too
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = (next_random() % 2001) / 1000.0f - 0.5f;
+    }
+    memcpy(expected, values, n * sizeof(float));
+    adjust_contrast_f32(values, num_pixels, c, contrast);
+    adjust_contrast_f32_ref(expected, num_pixels, c, contrast);
+
+    bool ok = true;
+    for (size_t i = 0; i < n && ok; ++i) {
+        if (values[i] != expected[i]) {
+            printf("adjust_contrast_f32 c=%d contrast=%g pixels=%d: value %zu "
+                   "is %.9g, expected %.9g\n",
+                   c, contrast, num_pixels, i, values[i], expected[i]);
+            ok = false;
+        }
+    }
+    free(values);
+    free(expected);
+    return ok;
+}
+
+static int test_cpu(void) {
+    int num_failed = 0;
+    for (int c = 1; c <= 4; ++c) {
+        for (int k = 0; k < NUM_CONTRASTS; ++k) {
+            for (int i = 0; i < NUM_LENGTHS; ++i) {
+                num_failed += !check_u8(c, contrasts[k], lengths[i]);
+                num_failed += !check_f32(c, contrasts[k], lengths[i]);
+            }
+        }
+    }
+    printf("%d of %d CPU checks failed\n", num_failed,
+           4 * NUM_CONTRASTS * NUM_LENGTHS * 2);
+    return num_failed == 0 ? 0 : 1;
+}
+
+typedef struct gpu_state {
+    VertexObject quad;
+    GLuint image_shader;
+    GLuint fbo;
+    TileGrid source, target;
+    TextureUpload upload;
+} GpuState;
+
+// Runs a random w x h image with c channels through the contrast pass, and
+// compares it with the CPU's result
+static bool check_gpu(GpuState* gpu, int w, int h, int c, float contrast) {
+    const size_t n = (size_t)w * h * c;
+    Image image = {.data = malloc(n), .w = w, .h = h, .c = c};
+    uint8_t* const expected = malloc(n);
+    uint8_t* const result = malloc(n);
+    bool ok = image.data != NULL && expected != NULL && result != NULL;
+    if (!ok) {
+        FATAL_ERROR("malloc failed\n");
+    }
+    for (size_t i = 0; i < n && ok; ++i) {
+        image.data[i] = next_random();
+    }
+    ok = ok && texture_upload_start(&gpu->upload, &gpu->source,
+                                    bpp_to_gl_image_format(c), &image);
+    if (ok) {
+        while (!texture_upload_step(&gpu->upload)) {
+        }
+        ok = setup_target_tiles(&gpu->target, &gpu->source, gpu->fbo);
+    }
+    if (ok) {
+        apply_contrast(&gpu->source, &gpu->target, gpu->fbo,
+                       gpu->image_shader, gpu->quad.vao, contrast);
+        read_tiles(&gpu->target, c, gpu->fbo, result);
+        memcpy(expected, image.data, n);
+        adjust_contrast(expected, (size_t)w * h, c, contrast);
+        for (size_t i = 0; i < n; ++i) {
+            if (abs(result[i] - expected[i]) > 1) {
+                printf("contrast pass %dx%d c=%d contrast=%g: value %zu is "
+                       "%d, the CPU's is %d\n",
+                       w, h, c, contrast, i, result[i], expected[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+    free(image.data);
+    free(expected);
+    free(result);
+    return ok;
+}
+
+static int test_gpu(void) {
+    HeadlessContext ctx;
+    if (!headless_context_init(&ctx)) {
+        printf("No GL context, skipping\n");
+        return TEST_SKIPPED;
+    }
+    gl_debug_init();
+
+    GpuState gpu;
+    const GLenum types[1] = {GL_FLOAT};
+    const uint8_t counts[1] = {2};
+    vertex_object_init(&gpu.quad, 1, types, counts);
+    build_quad_buffer(gpu.quad.vbo);
+    gpu.image_shader = get_image_shader();
+    GLDEBUG(glGenFramebuffers(1, &gpu.fbo));
+    tile_grid_init(&gpu.source);
+    tile_grid_init(&gpu.target);
+    texture_upload_init(&gpu.upload);
+
+    int num_failed = 0;
+    for (int c = 1; c <= 4; ++c) {
+        for (int k = 0; k < NUM_CONTRASTS; ++k) {
+            for (int i = 0; i < NUM_GPU_SIZES; ++i) {
+                num_failed += !check_gpu(&gpu, gpu_sizes[i][0],
+                                         gpu_sizes[i][1], c, contrasts[k]);
+            }
+        }
+    }
+    printf("%d of %d GPU checks failed\n", num_failed,
+           4 * NUM_CONTRASTS * NUM_GPU_SIZES);
+
+    texture_upload_deinit(&gpu.upload);
+    tile_grid_deinit(&gpu.source);
+    tile_grid_deinit(&gpu.target);
+    GLDEBUG(glDeleteFramebuffers(1, &gpu.fbo));
+    GLDEBUG(glDeleteProgram(gpu.image_shader));
+    vertex_object_deinit(&gpu.quad);
+    headless_context_deinit(&ctx);
+    return num_failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "--gpu") == 0) {
+        return test_gpu();
+    }
+    if (argc != 1) {
+        FATAL_ERROR("usage: test_adjust [--gpu]\n");
+        return 1;
+    }
+    return test_cpu();
+}
@@ -0,0 +1,106 @@
+// Checks that the SIMD kernels of the JPEG writer, the forward DCT and the
+// color conversion, produce exactly the same file as the plain C ones.
+
+#include "jpeg_write_variants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sizes that leave partial 8x8 and 16x16 blocks at the right and bottom
+static const int sizes[][2] = {
+    {1, 1}, {7, 5}, {8, 8}, {17, 9}, {33, 31}, {100, 75}, {257, 129},
+};
+#define NUM_SIZES (int)(sizeof(sizes) / sizeof(*sizes))
+
+// Up to 90 subsamples the chroma, above it doesn't
+static const int qualities[] = {10, 50, 90, 95, 100};
+#define NUM_QUALITIES (int)(sizeof(qualities) / sizeof(*qualities))
+
+typedef bool (*WriteJpg)(Encoded* out, int w, int h, int c,
+                         const uint8_t* pixels, int quality);
+
+static const WriteJpg variants[] = {write_jpg_sse2, write_jpg_default};
+static const char* const variant_names[] = {"sse2", "default"};
+#define NUM_VARIANTS (int)(sizeof(variants) / sizeof(*variants))
+
+// Gradients with noise on top, so every coefficient gets exercised, including
+// the clamped ends of the range
+static uint8_t* make_image(int w, int h, int c) {
+    uint8_t* const pixels = malloc((size_t)w * h * c);
+    if (pixels == NULL) {
+        return NULL;
+    }
+    uint32_t state = 0x9e3779b9u;
+    uint8_t* p = pixels;
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            for (int i = 0; i < c; ++i) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                const int value = (x * (i + 1) * 300 / w + y * 300 / h) / 2 +
+                                  (int)(state % 64) - 32;
+                *p++ = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+        }
+    }
+    return pixels;
+}
+
+static bool check(int w, int h, int c, int quality, const uint8_t* pixels) {
+    Encoded expected = {0};
+    if (!write_jpg_scalar(&expected, w, h, c, pixels, quality)) {
+        printf("%dx%d c=%d quality=%d: the scalar writer failed\n", w, h, c,
+               quality);
+        free(expected.data);
+        return false;
+    }
+    bool ok = true;
+    for (int v = 0; v < NUM_VARIANTS; ++v) {
+        Encoded result = {0};
+        if (!variants[v](&result, w, h, c, pixels, quality)) {
+            printf("%dx%d c=%d quality=%d: the %s writer failed\n", w, h, c,
+                   quality, variant_names[v]);
+            ok = false;
+        } else if (result.size != expected.size ||
+                   memcmp(result.data, expected.data, result.size) != 0) {
+            size_t i = 0;
+            while (i < result.size && i < expected.size &&
+                   result.data[i] == expected.data[i]) {
+                ++i;
+            }
+            printf("%dx%d c=%d quality=%d: the %s writer's %zu bytes differ "
+                   "from the scalar writer's %zu at byte %zu\n",
+                   w, h, c, quality, variant_names[v], result.size,
+                   expected.size, i);
+            ok = false;
+        }
+        free(result.data);
+    }
+    free(expected.data);
+    return ok;
+}
+
+int main(void) {
+    int num_failed = 0;
+    int num_checks = 0;
+    for (int s = 0; s < NUM_SIZES; ++s) {
+        const int w = sizes[s][0];
+        const int h = sizes[s][1];
+        for (int c = 1; c <= 4; ++c) {
+            uint8_t* const pixels = make_image(w, h, c);
+            if (pixels == NULL) {
+                fprintf(stderr, "Error: malloc failed\n");
+                return 1;
+            }
+            for (int q = 0; q < NUM_QUALITIES; ++q) {
+                num_failed += !check(w, h, c, qualities[q], pixels);
+                ++num_checks;
+            }
+            free(pixels);
+        }
+    }
+    printf("%d of %d JPEG writer checks failed\n", num_failed, num_checks);
+    return num_failed == 0 ? 0 : 1;
+}
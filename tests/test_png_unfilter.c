@@ -0,0 +1,238 @@
+// Checks that PNGs decode to exactly the same pixels with stb_image's SIMD
+// unfiltering as without it. The PNGs are generated here from random filtered
+// bytes, which are always valid, so every filter type can be forced on every
+// row, for every pixel size from 1 to 8 bytes.
+
+#include "png_load_variants.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// PNG color types
+enum {
+    COLOR_GREY = 0,
+    COLOR_RGB = 2,
+    COLOR_GREY_ALPHA = 4,
+    COLOR_RGBA = 6,
+};
+
+typedef struct format {
+    int color;
+    int channels;
+    int depth;
+} Format;
+
+// Pixels of 1, 2, 3, 4, 6 and 8 bytes, plus the packed grey depths which are
+// unfiltered a byte at a time
+static const Format formats[] = {
+    {COLOR_GREY, 1, 1},        {COLOR_GREY, 1, 2},  {COLOR_GREY, 1, 4},
+    {COLOR_GREY, 1, 8},        {COLOR_GREY, 1, 16}, {COLOR_GREY_ALPHA, 2, 8},
+    {COLOR_GREY_ALPHA, 2, 16}, {COLOR_RGB, 3, 8},   {COLOR_RGB, 3, 16},
+    {COLOR_RGBA, 4, 8},        {COLOR_RGBA, 4, 16},
+};
+#define NUM_FORMATS (int)(sizeof(formats) / sizeof(*formats))
+
+// Widths around the SIMD paths' groups of 4 pixels, and the height covers the
+// first row's special cases as well as rows with one above
+static const int widths[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 33, 100};
+#define NUM_WIDTHS (int)(sizeof(widths) / sizeof(*widths))
+#define HEIGHT 5
+
+// None, sub, up, average and Paeth, then a random one on each row
+#define NUM_FILTERS 5
+#define MIXED_FILTERS NUM_FILTERS
+
+static uint32_t random_state = 0x9e3779b9u;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+typedef struct buffer {
+    uint8_t* data;
+    size_t size;
+} Buffer;
+
+static uint32_t crc_table[256];
+
+static void init_crc_table(void) {
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    uint32_t c = 0xffffffffu;
+    for (size_t i = 0; i < size; ++i) {
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; ++i) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+static void put8(Buffer* out, uint8_t value) {
+    out->data[out->size++] = value;
+}
+
+static void put32(Buffer* out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        put8(out, value >> shift);
+    }
+}
+
+static void put_bytes(Buffer* out, const uint8_t* data, size_t size) {
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+// Writes a chunk whose data has already been put after where its header goes
+static void finish_chunk(Buffer* out, size_t start, const char* type) {
+    const size_t length = out->size - start - 8;
+    uint8_t* const header = out->data + start;
+    for (int i = 0; i < 4; ++i) {
+        header[i] = (uint8_t)(length >> (24 - 8 * i));
+        header[4 + i] = type[i];
+    }
+    put32(out, crc32(header + 4, length + 4));
+}
+
+// Wraps filtered scanlines in a PNG, compressed with stored deflate blocks
+static Buffer make_png(int w, int h, const Format* format,
+                       const uint8_t* filtered, size_t size) {
+    const size_t max_block = 65535;
+    const size_t num_blocks = size / max_block + 1;
+    Buffer out = {malloc(64 + size + num_blocks * 5), 0};
+    if (out.data == NULL) {
+        return out;
+    }
+    static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    put_bytes(&out, signature, sizeof(signature));
+
+    size_t start = out.size;
+    out.size += 8;
+    put32(&out, w);
+    put32(&out, h);
+    put8(&out, format->depth);
+    put8(&out, format->color);
+    put8(&out, 0); // deflate
+    put8(&out, 0); // adaptive filtering
+    put8(&out, 0); // not interlaced
+    finish_chunk(&out, start, "IHDR");
+
+    start = out.size;
+    out.size += 8;
+    put8(&out, 0x78);
+    put8(&out, 0x01);
+    size_t offset = 0;
+    do {
+        const size_t block = size - offset < max_block ? size - offset
+                                                       : max_block;
+        put8(&out, offset + block == size); // final block, stored
+        put8(&out, block & 0xff);
+        put8(&out, block >> 8);
+        put8(&out, ~block & 0xff);
+        put8(&out, (~block >> 8) & 0xff);
+        put_bytes(&out, filtered + offset, block);
+        offset += block;
+    } while (offset < size);
+    put32(&out, adler32(filtered, size));
+    finish_chunk(&out, start, "IDAT");
+
+    start = out.size;
+    out.size += 8;
+    finish_chunk(&out, start, "IEND");
+    return out;
+}
+
+static bool check(int w, const Format* format, int filter, int req_comp) {
+    const size_t row_bytes =
+        ((size_t)w * format->channels * format->depth + 7) / 8;
+    const size_t size = (row_bytes + 1) * HEIGHT;
+    uint8_t* const filtered = malloc(size);
+    if (filtered == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        return false;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        filtered[i] = next_random();
+    }
+    for (int y = 0; y < HEIGHT; ++y) {
+        filtered[y * (row_bytes + 1)] =
+            filter == MIXED_FILTERS ? (int)(next_random() % NUM_FILTERS) : filter;
+    }
+    Buffer png = make_png(w, HEIGHT, format, filtered, size);
+    free(filtered);
+    if (png.data == NULL) {
+        fprintf(stderr, "Error: malloc failed\n");
+        return false;
+    }
+
+    const int is_16 = format->depth == 16;
+    int w1, h1, c1, w2, h2, c2;
+    uint8_t* const expected = load_png_scalar(png.data, png.size, is_16, &w1,
+                                              &h1, &c1, req_comp);
+    uint8_t* const result = load_png_default(png.data, png.size, is_16, &w2,
+                                             &h2, &c2, req_comp);
+    free(png.data);
+
+    bool ok = true;
+    if (expected == NULL || result == NULL) {
+        printf("depth %d color %d width %d filter %d req_comp %d: failed to "
+               "decode\n",
+               format->depth, format->color, w, filter, req_comp);
+        ok = false;
+    } else {
+        const int out_c = req_comp ? req_comp : c1;
+        const size_t out_size = (size_t)w * HEIGHT * out_c * (is_16 ? 2 : 1);
+        if (w1 != w2 || h1 != h2 || c1 != c2 ||
+            memcmp(expected, result, out_size) != 0) {
+            printf("depth %d color %d width %d filter %d req_comp %d: the "
+                   "SIMD result differs\n",
+                   format->depth, format->color, w, filter, req_comp);
+            ok = false;
+        }
+    }
+    free(expected);
+    free(result);
+    return ok;
+}
+
+int main(void) {
+    init_crc_table();
+    int num_failed = 0;
+    int num_checks = 0;
+    for (int f = 0; f < NUM_FORMATS; ++f) {
+        const Format* const format = &formats[f];
+        for (int i = 0; i < NUM_WIDTHS; ++i) {
+            for (int filter = 0; filter <= MIXED_FILTERS; ++filter) {
+                num_failed += !check(widths[i], format, filter, 0);
+                ++num_checks;
+                // Adding an alpha channel while unfiltering is its own path
+                if (format->channels < 4) {
+                    num_failed += !check(widths[i], format, filter,
+                                         format->channels + 1);
+                    ++num_checks;
+                }
+            }
+        }
+    }
+    printf("%d of %d PNG unfilter checks failed\n", num_failed, num_checks);
+    return num_failed == 0 ? 0 : 1;
+}